@@ -3,11 +3,11 @@
 #include "atoin.h"
 
 /* implemented without overflow checking */
-int atoin(char *str, size_t n)
+int atoin(const char *str, size_t n)
 {
     int result = 0;
     for (size_t idx = 0; idx < n; idx++) {
-        char *cur = str + idx;
+        const char *cur = str + idx;
         int num;
 
         if (!isdigit(*cur))
@@ -1,3 +1,3 @@
 #include <stddef.h>
 
-int atoin(char *str, size_t n);
+int atoin(const char *str, size_t n);
@@ -0,0 +1,25 @@
+# usage: sh bench.sh <spawn|parse|sched|fuzz> [benchmark options]
+name=$1
+shift
+case "$name" in
+spawn)
+    gcc -O2 bench/spawn.c launch.c -o bench/spawn && ./bench/spawn "$@"
+    ;;
+parse)
+    gcc -O2 -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc \
+        bench/parse.c parse.c atoin.c -o bench/parse && ./bench/parse "$@"
+    ;;
+sched)
+    gcc -O2 bench/sched.c parse.c atoin.c sched.c clock.c file.c heap.c wheel.c index.c day.c engine.c vec.c hash.c share.c \
+        -o bench/sched && ./bench/sched "$@"
+    ;;
+fuzz)
+    mkdir -p bench/fuzz_corpus
+    clang -g -O1 -fsanitize=fuzzer,address,undefined bench/fuzz_parse.c parse.c atoin.c \
+        -o bench/fuzz_parse && ./bench/fuzz_parse "$@" bench/fuzz_corpus bench/corpus
+    ;;
+*)
+    echo "usage: sh bench.sh <spawn|parse|sched|fuzz> [options]"
+    exit 1
+    ;;
+esac
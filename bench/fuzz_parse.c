@@ -0,0 +1,25 @@
+/*
+ * libFuzzer entry point for the line parser, seeded with the corpus of the
+ * parse benchmark. New inputs go to bench/fuzz_corpus.
+ *
+ *   sh bench.sh fuzz [libFuzzer options]
+ */
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../cron.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    struct cron_assign assign;
+    cron_set crn_s;
+    char **argv;
+
+    parse_set_quiet(true);
+    /* like the loader, an assignment isn't parsed as an entry */
+    if (!parse_assign((const char *)data, size, &assign))
+        return 0;
+    if (!parse((const char *)data, size, &crn_s, &argv, NULL))
+        free(argv);
+    return 0;
+}
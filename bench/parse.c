@@ -0,0 +1,197 @@
+/*
+ * Parser throughput: expressions per second and allocations per expression
+ * for every line of the corpus (one file per line, shared with the fuzzer)
+ * and for generated comma lists of growing length, which show how the
+ * recursion per list item scales.
+ *
+ *   sh bench.sh parse [-d corpus dir] [-t seconds per case] [-l N,N,...]
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../util.h"
+#include "../cron.h"
+
+#define DEFAULT_CORPUS "bench/corpus"
+#define DEFAULT_SECONDS 0.2
+#define DEFAULT_LENGTHS "1,16,256,4096"
+#define MAX_LINE (1024 * 1024)
+
+/* linked with --wrap, counts the allocations of the parser */
+static size_t allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    ++allocs;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    ++allocs;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+    ++allocs;
+    return __real_realloc(p, size);
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* one line the way the loader sees it, 1 for an entry, 2 for an assignment */
+static int parse_line(const char *line, size_t len)
+{
+    struct cron_assign assign;
+    cron_set crn_s;
+    char **argv;
+
+    if (!parse_assign(line, len, &assign))
+        return 2;
+    if (parse(line, len, &crn_s, &argv, NULL))
+        return 0;
+    free(argv);
+    return 1;
+}
+
+static void bench_case(const char *name, const char *line, size_t len, double seconds)
+{
+    static const char *const kinds[] = { "error", "entry", "assign" };
+    size_t runs = 0;
+    size_t start_allocs;
+    double start;
+    double elapsed;
+    int kind = parse_line(line, len);
+
+    start_allocs = allocs;
+    start = now_s();
+    /* check the clock every 64 runs only */
+    do {
+        for (int i = 0; i < 64; i++)
+            parse_line(line, len);
+        runs += 64;
+        elapsed = now_s() - start;
+    } while (elapsed < seconds);
+
+    printf("%-24s %8zu %-6s %12.0f %10.1f %8.2f\n", name, len, kinds[kind],
+           runs / elapsed, elapsed * 1e9 / runs, (double)(allocs - start_allocs) / runs);
+    fflush(stdout);
+}
+
+static void bench_corpus(const char *dir, double seconds)
+{
+    struct dirent **names;
+    char *buf = malloc(MAX_LINE);
+    int n;
+
+    n = scandir(dir, &names, NULL, alphasort);
+    if (n < 0 || !buf) {
+        perror("Failed to read the corpus");
+        free(buf);
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        char path[4096];
+        FILE *f;
+        size_t len;
+
+        if (names[i]->d_name[0] == '.')
+            goto next;
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]->d_name);
+        f = fopen(path, "r");
+        if (!f)
+            goto next;
+        len = fread(buf, 1, MAX_LINE, f);
+        fclose(f);
+        /* the loader hands out lines without the newline */
+        if (len && buf[len - 1] == '\n')
+            --len;
+        bench_case(names[i]->d_name, buf, len, seconds);
+next:
+        free(names[i]);
+    }
+    free(names);
+    free(buf);
+}
+
+/* a minute field of n items, either plain values or range/step chains */
+static char *make_list(size_t n, bool chain)
+{
+    static const char tail[] = " * * * * /bin/true";
+    char *line = malloc(n * 16 + sizeof(tail));
+    char *pos = line;
+
+    if (!line)
+        return NULL;
+    for (size_t i = 0; i < n; i++) {
+        if (chain)
+            pos += sprintf(pos, "%s%zu-%zu/%zu", i ? "," : "", i % 50, i % 50 + 9, i % 4 + 1);
+        else
+            pos += sprintf(pos, "%s%zu", i ? "," : "", i % 60);
+    }
+    memcpy(pos, tail, sizeof(tail));
+    return line;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = DEFAULT_CORPUS;
+    double seconds = DEFAULT_SECONDS;
+    char default_lengths[] = DEFAULT_LENGTHS;
+    char *lengths = default_lengths;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:t:l:")) != -1) {
+        switch (opt) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 't':
+            seconds = strtod(optarg, NULL);
+            break;
+        case 'l':
+            lengths = optarg;
+            break;
+        default:
+            pr_err("usage: %s [-d corpus dir] [-t seconds per case] [-l N,N,...]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    parse_set_quiet(true);
+    printf("%-24s %8s %-6s %12s %10s %8s\n", "case", "bytes", "kind",
+           "exprs/s", "ns/expr", "allocs");
+    bench_corpus(dir, seconds);
+
+    for (char *tok = strtok(lengths, ","); tok; tok = strtok(NULL, ",")) {
+        size_t n = strtoul(tok, NULL, 10);
+
+        for (int chain = 0; chain <= 1; chain++) {
+            char name[32];
+            char *line = make_list(n, chain);
+
+            if (!line)
+                return -1;
+            snprintf(name, sizeof(name), "%s-%zu", chain ? "chain" : "list", n);
+            bench_case(name, line, strlen(line), seconds);
+            free(line);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,353 @@
+/*
+ * Cost of deciding which jobs fire: a simulated day of minute ticks over
+ * synthetic job sets with a realistic mix of schedules, evaluated by
+ * matching every job on every tick, the same grouped by the shape of the
+ * schedules with a matcher per shape, by matching every distinct schedule
+ * once, and by each scheduler engine fed the distinct schedules the way
+ * the daemon does, which only touches the ones that are due. Reports ns
+ * and cache misses per job and tick, the misses come from perf_event_open
+ * and read n/a where it isn't allowed.
+ *
+ *   sh bench.sh sched [-n N,N,...] [-m minutes] [-s seed]
+ */
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "../util.h"
+#include "../cron.h"
+#include "../engine.h"
+#include "../clock.h"
+#include "../share.h"
+#include "../vec.h"
+
+#define DEFAULT_SIZES "1000,100000,1000000"
+#define DEFAULT_MINUTES (24 * 60)
+#define DEFAULT_SEED 1
+#define ONE_MIN 60
+
+static const char *const engine_names[] = { "heap", "wheel", "index", "day" };
+
+static uint64_t rng;
+
+static uint32_t rand_next(void)
+{
+    /* xorshift64, the sets only have to be the same from run to run */
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng >> 32;
+}
+
+static uint32_t rand_below(uint32_t n)
+{
+    return rand_next() % n;
+}
+
+/*
+ * A schedule the way crontabs tend to look: a few jobs every minute, many
+ * hourly ones, steps of minutes and hours, and daily, weekly and monthly
+ * jobs, some of them with both day fields (the OR rule).
+ */
+static int make_set(cron_set *set)
+{
+    static const int steps[] = { 2, 5, 10, 15, 20, 30 };
+    char line[64];
+    uint32_t kind = rand_below(100);
+    int min = rand_below(60), hour = rand_below(24);
+    char **argv;
+
+    if (kind < 5)
+        snprintf(line, sizeof(line), "* * * * * x");
+    else if (kind < 35)
+        snprintf(line, sizeof(line), "%d * * * * x", min);
+    else if (kind < 50)
+        snprintf(line, sizeof(line), "*/%d * * * * x", steps[rand_below(ARRAY_SIZE(steps))]);
+    else if (kind < 60)
+        snprintf(line, sizeof(line), "%d */%d * * * x", min, 2 + rand_below(5));
+    else if (kind < 75)
+        snprintf(line, sizeof(line), "%d %d * * * x", min, hour);
+    else if (kind < 85)
+        snprintf(line, sizeof(line), "%d %d * * %d x", min, hour, 1 + rand_below(7));
+    else if (kind < 95)
+        snprintf(line, sizeof(line), "%d %d %d * * x", min, hour, 1 + rand_below(28));
+    else
+        snprintf(line, sizeof(line), "%d %d 1,15 * %d x", min, hour, 1 + rand_below(7));
+
+    if (parse(line, strlen(line), set, &argv, NULL))
+        return -1;
+    free(argv);
+    return 0;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* -1 when the counter isn't available, e.g. under perf_event_paranoid */
+static int perf_open(void)
+{
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HARDWARE,
+        .size = sizeof(attr),
+        .config = PERF_COUNT_HW_CACHE_MISSES,
+        .disabled = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void perf_start(int fd)
+{
+    if (fd == -1)
+        return;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+static long long perf_stop(int fd)
+{
+    long long count;
+
+    if (fd == -1)
+        return -1;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+        return -1;
+    return count;
+}
+
+static void report(size_t n, const char *mode, size_t minutes, size_t fires,
+                   double ns, long long misses)
+{
+    double evals = (double)n * minutes;
+    char miss[32] = "n/a";
+
+    if (misses >= 0)
+        snprintf(miss, sizeof(miss), "%.4f", misses / evals);
+    printf("%10zu %-6s %10zu %12.3f %14s\n", n, mode, fires, ns / evals, miss);
+    fflush(stdout);
+}
+
+/* the baseline, every job is matched against the broken-down time of every tick */
+static void bench_match(const cron_set *sets, size_t n, time_t start, size_t minutes, int perf)
+{
+    struct clock_zone *zone = clock__local_zone();
+    size_t fires = 0;
+    long long misses;
+    double t0, ns;
+
+    perf_start(perf);
+    t0 = now_ns();
+    for (size_t m = 0; m < minutes; m++) {
+        time_t t = start + m * ONE_MIN;
+        struct tm info;
+
+        clock__local(zone, t, &info);
+        for (size_t i = 0; i < n; i++)
+            fires += cron__should_exec(&sets[i], &info);
+    }
+    ns = now_ns() - t0;
+    misses = perf_stop(perf);
+    report(n, "match", minutes, fires, ns, misses);
+}
+
+/*
+ * The jobs grouped by shape, each group goes through the matcher bound to
+ * its shape. Grouping happens once at start and isn't timed.
+ */
+static void bench_shaped(const cron_set *sets, size_t n, time_t start, size_t minutes, int perf)
+{
+    struct clock_zone *zone = clock__local_zone();
+    cron_set *sorted = malloc(n * sizeof(*sorted));
+    size_t first[CRON_SHAPE_NUM + 1] = { 0 };
+    size_t fires = 0;
+    long long misses;
+    double t0, ns;
+
+    if (!sorted)
+        return;
+    for (size_t i = 0; i < n; i++)
+        first[sets[i].shape + 1]++;
+    for (int s = 1; s <= CRON_SHAPE_NUM; s++)
+        first[s] += first[s - 1];
+    for (size_t i = 0, pos[CRON_SHAPE_NUM] = { 0 }; i < n; i++)
+        sorted[first[sets[i].shape] + pos[sets[i].shape]++] = sets[i];
+
+    perf_start(perf);
+    t0 = now_ns();
+    for (size_t m = 0; m < minutes; m++) {
+        time_t t = start + m * ONE_MIN;
+        struct tm info;
+
+        clock__local(zone, t, &info);
+        for (int s = 0; s < CRON_SHAPE_NUM; s++) {
+            cron_match_fn match;
+
+            if (first[s] == first[s + 1])
+                continue;
+            match = cron__matcher(&sorted[first[s]]);
+            for (size_t i = first[s]; i < first[s + 1]; i++)
+                fires += match(&sorted[i], &info);
+        }
+    }
+    ns = now_ns() - t0;
+    misses = perf_stop(perf);
+    report(n, "shaped", minutes, fires, ns, misses);
+    free(sorted);
+}
+
+/* each distinct schedule is matched once per tick and a match fires all its jobs */
+static void bench_shared(const struct share_tab *st, size_t n, time_t start, size_t minutes,
+                         int perf)
+{
+    struct clock_zone *zone = clock__local_zone();
+    const cron_set *sets = __vec__at(st->sets, 0);
+    const struct share *shares = __vec__at(st->shares, 0);
+    size_t nshares = vec__len_st(st->shares);
+    size_t fires = 0;
+    long long misses;
+    double t0, ns;
+
+    perf_start(perf);
+    t0 = now_ns();
+    for (size_t m = 0; m < minutes; m++) {
+        time_t t = start + m * ONE_MIN;
+        struct tm info;
+
+        clock__local(zone, t, &info);
+        for (size_t i = 0; i < nshares; i++) {
+            if (cron__should_exec(&sets[i], &info))
+                fires += vec__len_st(shares[i].jobs);
+        }
+    }
+    ns = now_ns() - t0;
+    misses = perf_stop(perf);
+    report(n, "shared", minutes, fires, ns, misses);
+}
+
+/*
+ * The daemon's loop without the launches: pop the schedules that are due,
+ * fire their jobs and schedule their next fire. Filling the engine happens
+ * once at start and isn't timed.
+ */
+static void bench_engine(const struct engine *engine, const struct share_tab *st, size_t n,
+                         time_t start, size_t minutes, int perf)
+{
+    void *sched = engine->new(start);
+    size_t fires = 0;
+    long long misses;
+    double t0, ns;
+
+    if (!sched)
+        return;
+    for (size_t i = 0; i < vec__len_st(st->shares); i++) {
+        const cron_set *crn_s = __vec__at(st->sets, i);
+        time_t next = cron_next_fire(crn_s, NULL, start - 1);
+
+        if (next != -1 && engine->add(sched, next, i, crn_s, NULL))
+            goto out;
+    }
+
+    perf_start(perf);
+    t0 = now_ns();
+    for (size_t m = 0; m < minutes; m++) {
+        time_t t = start + m * ONE_MIN;
+        size_t id;
+        int popped;
+
+        while ((popped = engine->pop(sched, t, &id)) > 0) {
+            struct share *share = __vec__at(st->shares, id);
+            const cron_set *crn_s = __vec__at(st->sets, id);
+            time_t next = cron_next_fire(crn_s, NULL, t);
+
+            fires += vec__len_st(share->jobs);
+            if (next != -1 && engine->add(sched, next, id, crn_s, NULL))
+                goto out;
+        }
+        if (popped < 0)
+            goto out;
+    }
+    ns = now_ns() - t0;
+    misses = perf_stop(perf);
+    report(n, engine->name, minutes, fires, ns, misses);
+out:
+    engine->free(sched);
+}
+
+int main(int argc, char **argv)
+{
+    char default_sizes[] = DEFAULT_SIZES;
+    char *sizes = default_sizes;
+    size_t minutes = DEFAULT_MINUTES;
+    /* a Monday and the first of the month, so that every kind of job fires */
+    struct tm day = { .tm_year = 2026 - 1900, .tm_mon = 5, .tm_mday = 1, .tm_isdst = -1 };
+    time_t start = mktime(&day);
+    int perf = perf_open();
+    int opt;
+
+    rng = DEFAULT_SEED;
+    while ((opt = getopt(argc, argv, "n:m:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            sizes = optarg;
+            break;
+        case 'm':
+            minutes = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            rng = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            pr_err("usage: %s [-n N,N,...] [-m minutes] [-s seed]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (!minutes || !rng)
+        return -1;
+
+    printf("%10s %-6s %10s %12s %14s\n", "jobs", "mode", "fires", "ns/job/tick",
+           "miss/job/tick");
+    for (char *tok = strtok(sizes, ","); tok; tok = strtok(NULL, ",")) {
+        size_t n = strtoul(tok, NULL, 10);
+        cron_set *sets = malloc(n * sizeof(*sets));
+        struct share_tab st;
+        size_t id, pos;
+
+        if (!sets || share__init(&st)) {
+            free(sets);
+            return -1;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (make_set(&sets[i]) || share__add(&st, &sets[i], NULL, i, &id, &pos)) {
+                share__free(&st);
+                free(sets);
+                return -1;
+            }
+        }
+        printf("%10zu jobs share %zu schedules\n", n, st.live);
+
+        bench_match(sets, n, start, minutes, perf);
+        bench_shaped(sets, n, start, minutes, perf);
+        bench_shared(&st, n, start, minutes, perf);
+        for (size_t e = 0; e < ARRAY_SIZE(engine_names); e++)
+            bench_engine(engine__find(engine_names[e]), &st, n, start, minutes, perf);
+        share__free(&st);
+        free(sets);
+    }
+    if (perf != -1)
+        close(perf);
+    return 0;
+}
@@ -0,0 +1,263 @@
+/*
+ * Launch throughput of the ways a job can be started: jobs per second and
+ * fork-to-exec latency percentiles, with the daemon's resident size grown
+ * artificially, for single launches and for bursts of simultaneous fires.
+ *
+ *   sh bench.sh spawn [-n runs] [-b burst] [-m MB,MB,...] [-c command]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../util.h"
+#include "../launch.h"
+
+#define DEFAULT_RUNS 200
+#define DEFAULT_BURST 1000
+#define DEFAULT_CMD "/bin/true"
+#define MB (1024 * 1024)
+#define CLONE_STACK (64 * 1024)
+
+extern char **environ;
+
+static sigset_t mask;
+static char clone_stack[CLONE_STACK] __attribute__((aligned(16)));
+
+static pid_t bench_fork(char **argv)
+{
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+static pid_t bench_vfork(char **argv)
+{
+    pid_t pid = vfork();
+
+    if (pid == 0) {
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+static pid_t bench_posix_spawn(char **argv)
+{
+    pid_t pid;
+
+    if (posix_spawn(&pid, argv[0], NULL, NULL, argv, environ))
+        return -1;
+    return pid;
+}
+
+#ifdef __linux__
+static int clone_child(void *arg)
+{
+    char **argv = arg;
+
+    execv(argv[0], argv);
+    _exit(127);
+}
+
+static pid_t bench_clone_vfork(char **argv)
+{
+    return clone(clone_child, clone_stack + CLONE_STACK,
+                 CLONE_VM | CLONE_VFORK | SIGCHLD, argv);
+}
+#endif
+
+/* the launchers the daemon uses */
+static pid_t bench_cron_spawn(char **argv)
+{
+    struct launch_attr attr = { .sigmask = &mask };
+
+    return spawn_launcher.launch(argv, &attr);
+}
+
+static pid_t bench_cron_fork(char **argv)
+{
+    struct launch_attr attr = { .sigmask = &mask };
+
+    return fork_launcher.launch(argv, &attr);
+}
+
+static const struct {
+    const char *name;
+    pid_t (*launch)(char **argv);
+} methods[] = {
+    { "fork", bench_fork },
+    { "vfork", bench_vfork },
+    { "posix_spawn", bench_posix_spawn },
+#ifdef __linux__
+    { "clone_vfork", bench_clone_vfork },
+#endif
+    { "cron:spawn", bench_cron_spawn },
+    { "cron:fork", bench_cron_fork },
+};
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void report(const char *name, size_t rss_mb, const char *mode,
+                   double *lat, size_t n, double elapsed_us)
+{
+    qsort(lat, n, sizeof(*lat), cmp_double);
+    printf("%-12s %8zu %-7s %12.0f %9.1f %9.1f %9.1f %9.1f\n", name, rss_mb, mode,
+           n / (elapsed_us / 1e6), lat[n / 2], lat[n * 9 / 10], lat[n * 99 / 100], lat[n - 1]);
+    fflush(stdout);
+}
+
+/*
+ * One launch at a time. The child inherits the write end of a close-on-exec
+ * pipe, read() returns EOF as soon as the exec happened, which gives the
+ * fork-to-exec latency whether or not the launcher waits for the exec.
+ */
+static void bench_single(int m, size_t rss_mb, char **argv, size_t runs, double *lat)
+{
+    double start = now_us();
+    size_t ok = 0;
+
+    for (size_t i = 0; i < runs; i++) {
+        int fds[2];
+        double t0;
+        pid_t pid;
+        char c;
+
+        if (pipe2(fds, O_CLOEXEC))
+            break;
+        t0 = now_us();
+        pid = methods[m].launch(argv);
+        close(fds[1]);
+        if (pid > 0) {
+            while (read(fds[0], &c, 1) == -1 && errno == EINTR) {}
+            lat[ok++] = now_us() - t0;
+            waitpid(pid, NULL, 0);
+        }
+        close(fds[0]);
+    }
+    if (ok)
+        report(methods[m].name, rss_mb, "single", lat, ok, now_us() - start);
+}
+
+/*
+ * burst launches back to back, like jobs that fire in the same minute. The
+ * latency is the time the scheduler is held up by each launch, the rate
+ * counts launches until the last one returned.
+ */
+static void bench_burst(int m, size_t rss_mb, char **argv, size_t burst, double *lat, pid_t *pids)
+{
+    double start = now_us();
+    double elapsed;
+    size_t ok = 0;
+
+    for (size_t i = 0; i < burst; i++) {
+        double t0 = now_us();
+        pid_t pid = methods[m].launch(argv);
+
+        if (pid > 0) {
+            lat[ok] = now_us() - t0;
+            pids[ok++] = pid;
+        }
+    }
+    elapsed = now_us() - start;
+    for (size_t i = 0; i < ok; i++)
+        waitpid(pids[i], NULL, 0);
+    if (ok)
+        report(methods[m].name, rss_mb, "burst", lat, ok, elapsed);
+}
+
+int main(int argc, char **argv)
+{
+    size_t runs = DEFAULT_RUNS;
+    size_t burst = DEFAULT_BURST;
+    char default_sizes[] = "1,16,256,1024";
+    char *sizes = default_sizes;
+    char *cmd[] = { DEFAULT_CMD, NULL };
+    char *ballast = NULL;
+    size_t ballast_mb = 0;
+    double *lat;
+    pid_t *pids;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:b:m:c:")) != -1) {
+        switch (opt) {
+        case 'n':
+            runs = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            burst = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            sizes = optarg;
+            break;
+        case 'c':
+            cmd[0] = optarg;
+            break;
+        default:
+            pr_err("usage: %s [-n runs] [-b burst] [-m MB,MB,...] [-c command]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (!runs || !burst)
+        return -1;
+
+    sigprocmask(SIG_BLOCK, NULL, &mask);
+    lat = malloc(max(runs, burst) * sizeof(*lat));
+    pids = malloc(burst * sizeof(*pids));
+    if (!lat || !pids)
+        return -1;
+
+    printf("%-12s %8s %-7s %12s %9s %9s %9s %9s\n", "method", "rss_mb", "mode",
+           "launches/s", "p50_us", "p90_us", "p99_us", "max_us");
+    for (char *tok = strtok(sizes, ","); tok; tok = strtok(NULL, ",")) {
+        size_t mb = strtoul(tok, NULL, 10);
+
+        /* grow the resident size, touching every page */
+        if (mb > ballast_mb) {
+            char *grown = realloc(ballast, mb * MB);
+
+            if (!grown) {
+                pr_err("Can't allocate %zu MB\n", mb);
+                break;
+            }
+            ballast = grown;
+            memset(ballast, 1, mb * MB);
+            ballast_mb = mb;
+        }
+
+        for (size_t m = 0; m < ARRAY_SIZE(methods); m++) {
+            bench_single(m, mb, cmd, runs, lat);
+            bench_burst(m, mb, cmd, burst, lat, pids);
+        }
+    }
+
+    free(ballast);
+    free(lat);
+    free(pids);
+    return 0;
+}
@@ -0,0 +1,360 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "vec.h"
+#include "cache.h"
+
+/*
+ * A binary image of the job table, written next to the crontab and mapped
+ * on the next start in place of parsing as long as the crontab is the
+ * same. It is in native byte order and laid out as
+ *
+ *   struct cache_header
+ *   struct cache_job[njobs]
+ *   uint64_t assigns[nassigns]  offsets of the NAME=value strings, in order
+ *   uint64_t zones[nzones]      offsets of the CRON_TZ names, in order
+ *   char strings[strings_len]   NUL terminated, a job's arguments back to back
+ *
+ * The environments are built again from the assignments, they depend on
+ * the environment of the daemon.
+ */
+
+#define CACHE_MAGIC "CRONIMG"
+#define CACHE_VERSION 4
+#define CACHE_ORDER 0x01020304
+
+struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t order; /* CACHE_ORDER, tells a foreign byte order apart */
+    uint64_t job_size;
+    uint64_t src_len;
+    uint64_t src_hash;
+    uint64_t njobs;
+    uint64_t nassigns;
+    uint64_t nzones;
+    uint64_t strings_len;
+};
+
+struct cache_job {
+    cron_set crn_s;
+    uint64_t key;
+    uint64_t argv; /* offset of the first argument in strings */
+    uint32_t argc;
+    int32_t env; /* index of the last assignment above, -1 if none */
+    int32_t line;
+    int32_t max_running;
+    int32_t zone; /* index of the CRON_TZ zone, -1 for the daemon's */
+};
+
+/* the NUL terminated string at off, NULL if it doesn't fit */
+static const char *cache__str(const char *strings, uint64_t len, uint64_t off)
+{
+    if (off >= len || !memchr(strings + off, '\0', len - off))
+        return NULL;
+    return strings + off;
+}
+
+static const struct cache_header *cache__check(const struct file_map *map,
+                                               const char *src, size_t len)
+{
+    const struct cache_header *hdr = (const void *)map->data;
+    uint64_t size = sizeof(*hdr);
+
+    if (map->len < sizeof(*hdr) || memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) ||
+        hdr->version != CACHE_VERSION || hdr->order != CACHE_ORDER ||
+        hdr->job_size != sizeof(struct cache_job))
+        return NULL;
+    if (hdr->src_len != len || hdr->src_hash != hash__data(src, len))
+        return NULL;
+    if (hdr->njobs > map->len / sizeof(struct cache_job) ||
+        hdr->nassigns > map->len / sizeof(uint64_t) ||
+        hdr->nzones > map->len / sizeof(uint64_t) || hdr->strings_len > map->len)
+        return NULL;
+    size += hdr->njobs * sizeof(struct cache_job) +
+            (hdr->nassigns + hdr->nzones) * sizeof(uint64_t) + hdr->strings_len;
+    return size == map->len ? hdr : NULL;
+}
+
+/* the environments, each one extends the one before */
+static int cache__envs(struct cron_tab *tab, const uint64_t *assigns, uint64_t n,
+                       const char *strings, uint64_t strings_len)
+{
+    char **env = NULL;
+
+    for (uint64_t i = 0; i < n; i++) {
+        const char *str = cache__str(strings, strings_len, assigns[i]);
+        const char *eq = str ? strchr(str, '=') : NULL;
+        struct cron_assign assign;
+
+        if (!eq)
+            return -1;
+        assign.name = str;
+        assign.name_len = eq - str;
+        assign.value = eq + 1;
+        assign.value_len = strlen(eq + 1);
+        env = env_set(env, &assign, &tab->env_arena.base);
+        if (!env || __vec__push(tab->envs, &env, sizeof(env)))
+            return -1;
+    }
+    return 0;
+}
+
+/* the zones in the order of tab->zones when the image was written */
+static int cache__zones(struct cron_tab *tab, const uint64_t *zones, uint64_t n,
+                        const char *strings, uint64_t strings_len)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        const char *name = cache__str(strings, strings_len, zones[i]);
+        struct clock_zone *zone;
+
+        if (!name || tab__zone(tab, name, strlen(name), &zone) || !zone ||
+            vec__len_st(tab->zones) != i + 1)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Fills a freshly initialized tab from the image at path if it was made
+ * from the crontab src. Returns -1 when it can't be used, tab has to be
+ * freed then.
+ */
+int cache__load(struct cron_tab *tab, const char *path, const char *src, size_t len)
+{
+    struct file_map map;
+    const struct cache_header *hdr;
+    const struct cache_job *jobs;
+    const uint64_t *assigns;
+    const uint64_t *zones;
+    const char *strings;
+    size_t nargv = 0;
+    char **argv;
+
+    if (tab->live || tab->image.data || file__map(path, &map))
+        return -1;
+    hdr = cache__check(&map, src, len);
+    if (!hdr)
+        goto err;
+    jobs = (const void *)(hdr + 1);
+    assigns = (const void *)(jobs + hdr->njobs);
+    zones = assigns + hdr->nassigns;
+    strings = (const char *)(zones + hdr->nzones);
+
+    for (uint64_t i = 0; i < hdr->njobs; i++) {
+        uint64_t off = jobs[i].argv;
+
+        if (!jobs[i].argc || jobs[i].env < -1 || jobs[i].env >= (int64_t)hdr->nassigns ||
+            jobs[i].zone < -1 || jobs[i].zone >= (int64_t)hdr->nzones)
+            goto err;
+        for (uint32_t j = 0; j < jobs[i].argc; j++) {
+            const char *arg = cache__str(strings, hdr->strings_len, off);
+
+            if (!arg)
+                goto err;
+            off += strlen(arg) + 1;
+        }
+        nargv += jobs[i].argc + 1;
+    }
+
+    /* from here on the table frees the image */
+    argv = malloc(nargv * sizeof(char *));
+    if (!argv)
+        goto err;
+    tab->image = map;
+    tab->image_argv = argv;
+    tab->image_nargv = nargv;
+
+    if (cache__envs(tab, assigns, hdr->nassigns, strings, hdr->strings_len) ||
+        cache__zones(tab, zones, hdr->nzones, strings, hdr->strings_len))
+        return -1;
+
+    tab__begin(tab);
+    /* the keys are only needed once the crontab changes */
+    tab->indexed = false;
+    for (uint64_t i = 0; i < hdr->njobs; i++) {
+        const char *arg = strings + jobs[i].argv;
+        struct clock_zone *zone = NULL;
+        cron_job job;
+
+        memset(&job, 0, sizeof(job));
+        job.key = jobs[i].key;
+        job.line = jobs[i].line;
+        job.max_running = jobs[i].max_running;
+        job.seen = tab->gen;
+        if (jobs[i].env != -1)
+            job.envp = *(char ***)__vec__at(tab->envs, jobs[i].env);
+        if (jobs[i].zone != -1)
+            zone = *(struct clock_zone **)__vec__at(tab->zones, jobs[i].zone);
+        job.argv = argv;
+        for (uint32_t j = 0; j < jobs[i].argc; j++) {
+            *argv++ = (char *)arg;
+            arg += strlen(arg) + 1;
+        }
+        *argv++ = NULL;
+        if (tab__add(tab, &jobs[i].crn_s, zone, &job))
+            return -1;
+    }
+    pr_debug("Loaded %zu jobs from %s\n", tab->live, path);
+    return 0;
+err:
+    file__unmap(&map);
+    return -1;
+}
+
+/* the assignment that made env, the variable env_set() put last */
+static const char *cache__assign(char **env)
+{
+    while (env[1])
+        ++env;
+    return *env;
+}
+
+/* hmap takes its slot from the low bits, which are zero in a pointer */
+static uint64_t cache__ptr_key(char **env)
+{
+    return hash__mix(HASH_SEED, (uintptr_t)env);
+}
+
+/* index of the zone in tab->zones, -1 for the daemon's */
+static int32_t cache__zone(struct cron_tab *tab, const struct clock_zone *zone)
+{
+    for (size_t i = 0; zone && i < vec__len_st(tab->zones); i++) {
+        if (*(struct clock_zone **)__vec__at(tab->zones, i) == zone)
+            return i;
+    }
+    return -1;
+}
+
+static int cache__write(struct cron_tab *tab, FILE *f, const struct hmap *envs,
+                        const char *src, size_t len)
+{
+    struct cache_header hdr;
+    uint64_t off = 0;
+    size_t njobs = vec__len_st(tab->jobs);
+    size_t nenvs = vec__len_st(tab->envs);
+    size_t nzones = vec__len_st(tab->zones);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = CACHE_VERSION;
+    hdr.order = CACHE_ORDER;
+    hdr.job_size = sizeof(struct cache_job);
+    hdr.src_len = len;
+    hdr.src_hash = hash__data(src, len);
+    hdr.njobs = tab->live;
+    hdr.nassigns = nenvs;
+    hdr.nzones = nzones;
+    for (size_t id = 0; id < njobs; id++) {
+        cron_job *job = __vec__at(tab->jobs, id);
+
+        for (char **arg = job->argv; !job->dead && *arg; ++arg)
+            hdr.strings_len += strlen(*arg) + 1;
+    }
+    for (size_t i = 0; i < nenvs; i++)
+        hdr.strings_len += strlen(cache__assign(*(char ***)__vec__at(tab->envs, i))) + 1;
+    for (size_t i = 0; i < nzones; i++)
+        hdr.strings_len += strlen((*(struct clock_zone **)__vec__at(tab->zones, i))->name) + 1;
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+        return -1;
+
+    for (size_t id = 0; id < njobs; id++) {
+        cron_job *job = __vec__at(tab->jobs, id);
+        struct share *share;
+        struct cache_job rec;
+        size_t iter = 0;
+
+        if (job->dead)
+            continue;
+        share = __vec__at(tab->shares.shares, job->share);
+        /* no padding with garbage in it */
+        memset(&rec, 0, sizeof(rec));
+        rec.crn_s = *(cron_set *)__vec__at(tab->shares.sets, job->share);
+        rec.key = job->key;
+        rec.argv = off;
+        rec.env = job->envp ? (int32_t)hmap__next(envs, cache__ptr_key(job->envp), &iter) : -1;
+        rec.line = job->line;
+        rec.max_running = job->max_running;
+        rec.zone = cache__zone(tab, share->zone);
+        for (char **arg = job->argv; *arg; ++arg) {
+            ++rec.argc;
+            off += strlen(*arg) + 1;
+        }
+        if (fwrite(&rec, sizeof(rec), 1, f) != 1)
+            return -1;
+    }
+    for (size_t i = 0; i < nenvs; i++) {
+        if (fwrite(&off, sizeof(off), 1, f) != 1)
+            return -1;
+        off += strlen(cache__assign(*(char ***)__vec__at(tab->envs, i))) + 1;
+    }
+    for (size_t i = 0; i < nzones; i++) {
+        if (fwrite(&off, sizeof(off), 1, f) != 1)
+            return -1;
+        off += strlen((*(struct clock_zone **)__vec__at(tab->zones, i))->name) + 1;
+    }
+
+    for (size_t id = 0; id < njobs; id++) {
+        cron_job *job = __vec__at(tab->jobs, id);
+
+        for (char **arg = job->argv; !job->dead && *arg; ++arg) {
+            if (fwrite(*arg, strlen(*arg) + 1, 1, f) != 1)
+                return -1;
+        }
+    }
+    for (size_t i = 0; i < nenvs; i++) {
+        const char *assign = cache__assign(*(char ***)__vec__at(tab->envs, i));
+
+        if (fwrite(assign, strlen(assign) + 1, 1, f) != 1)
+            return -1;
+    }
+    for (size_t i = 0; i < nzones; i++) {
+        const char *name = (*(struct clock_zone **)__vec__at(tab->zones, i))->name;
+
+        if (fwrite(name, strlen(name) + 1, 1, f) != 1)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Writes the image of tab, loaded from the crontab src, to path. It is
+ * renamed into place, so a running daemon with the old image mapped keeps
+ * a consistent copy.
+ */
+int cache__save(struct cron_tab *tab, const char *path, const char *src, size_t len)
+{
+    char tmp[PATH_MAX];
+    struct hmap envs;
+    FILE *f;
+    int err;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+        return -1;
+    if (hmap__init(&envs))
+        return -1;
+    for (size_t i = 0; i < vec__len_st(tab->envs); i++) {
+        if (hmap__add(&envs, cache__ptr_key(*(char ***)__vec__at(tab->envs, i)), i)) {
+            hmap__free(&envs);
+            return -1;
+        }
+    }
+
+    f = fopen(tmp, "w");
+    if (!f) {
+        hmap__free(&envs);
+        return -1;
+    }
+    err = cache__write(tab, f, &envs, src, len);
+    if (fclose(f) == EOF)
+        err = -1;
+    if (!err && rename(tmp, path))
+        err = -1;
+    if (err)
+        remove(tmp);
+    hmap__free(&envs);
+    return err;
+}
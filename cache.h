@@ -0,0 +1,11 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+
+#include "tab.h"
+
+int cache__load(struct cron_tab *tab, const char *path, const char *src, size_t len);
+int cache__save(struct cron_tab *tab, const char *path, const char *src, size_t len);
+
+#endif
@@ -0,0 +1,145 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#ifdef __linux__
+#include <sys/signalfd.h>
+#endif
+
+#include "util.h"
+#include "vec.h"
+#include "child.h"
+
+#ifndef __linux__
+/* write end of the self-pipe, written from the SIGCHLD handler */
+static int sigchld_wfd = -1;
+
+static void sigchld_handler(int sig)
+{
+    int saved_errno = errno;
+    char c = 0;
+
+    (void)sig;
+    /* a full pipe already has a wakeup pending */
+    if (write(sigchld_wfd, &c, 1) == -1) {}
+    errno = saved_errno;
+}
+#endif
+
+/*
+ * SIGCHLD is turned into a readable fd, with signalfd on Linux and a
+ * self-pipe elsewhere, so that the scheduler can poll it together with its
+ * timeout instead of blocking in waitpid()
+ */
+int children__init(struct children *c)
+{
+    sigset_t mask;
+
+    c->fd = -1;
+    c->wfd = -1;
+    c->table = vec__new(sizeof(struct child));
+    if (!c->table)
+        return -1;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+#ifdef __linux__
+    if (sigprocmask(SIG_BLOCK, &mask, &c->oldmask))
+        goto err;
+    c->fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (c->fd == -1)
+        goto err;
+#else
+    int fds[2];
+    struct sigaction sa = { 0 };
+
+    if (sigprocmask(SIG_BLOCK, NULL, &c->oldmask))
+        goto err;
+    if (pipe(fds))
+        goto err;
+    c->fd = fds[0];
+    c->wfd = fds[1];
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    sigchld_wfd = c->wfd;
+    sa.sa_handler = sigchld_handler;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGCHLD, &sa, NULL))
+        goto err;
+#endif
+    return 0;
+err:
+    perror("Failed to set up SIGCHLD handling");
+    children__free(c);
+    return -1;
+}
+
+void children__free(struct children *c)
+{
+    if (c->fd != -1)
+        close(c->fd);
+    if (c->wfd != -1)
+        close(c->wfd);
+    c->fd = -1;
+    c->wfd = -1;
+    vec__free(c->table);
+    c->table = NULL;
+}
+
+int children__add(struct children *c, pid_t pid, size_t id)
+{
+    struct child child = { .pid = pid, .id = id };
+
+    return __vec__push(c->table, &child, sizeof(child));
+}
+
+size_t children__running(const struct children *c)
+{
+    return vec__len_st(c->table);
+}
+
+/* empties the fd so that poll blocks again until the next SIGCHLD */
+static void children__drain(struct children *c)
+{
+#ifdef __linux__
+    struct signalfd_siginfo info[16];
+#else
+    char info[64];
+#endif
+
+    while (read(c->fd, info, sizeof(info)) > 0) {}
+}
+
+/*
+ * Reaps one exited child, returns 1 and fills in the job id and the wait
+ * status, or 0 when no child is left to reap
+ */
+int children__reap(struct children *c, size_t *id, int *status)
+{
+    pid_t pid;
+
+    children__drain(c);
+    while ((pid = waitpid(-1, status, WNOHANG)) > 0) {
+        size_t len = vec__len_st(c->table);
+
+        for (size_t i = 0; i < len; i++) {
+            struct child *child = __vec__at(c->table, i);
+
+            if (child->pid != pid)
+                continue;
+            *id = child->id;
+            /* order doesn't matter, move the last one into the hole */
+            *child = *(struct child *)__vec__at(c->table, len - 1);
+            vec__pop(c->table);
+            return 1;
+        }
+        pr_debug("Reaped unknown child %d\n", pid);
+    }
+    return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef CHILD_H
+#define CHILD_H
+
+#include <stddef.h>
+#include <signal.h>
+#include <sys/types.h>
+
+/* a running job */
+struct child {
+    pid_t pid;
+    size_t id; /* index of the job in the job table */
+};
+
+struct children {
+    int fd; /* readable once a child exited */
+    int wfd; /* write end of the self-pipe where signalfd is missing */
+    sigset_t oldmask; /* signal mask to restore in the children */
+    struct child *table; /* vector of the running children */
+};
+
+int children__init(struct children *c);
+void children__free(struct children *c);
+int children__add(struct children *c, pid_t pid, size_t id);
+int children__reap(struct children *c, size_t *id, int *status);
+size_t children__running(const struct children *c);
+
+#endif
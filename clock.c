@@ -0,0 +1,588 @@
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "vec.h"
+#include "file.h"
+#include "clock.h"
+
+#define ONE_MIN 60
+#define ONE_HOUR (60 * 60L)
+#define ONE_DAY (24 * ONE_HOUR)
+/* offsets are sampled this far apart, zones don't change twice in between */
+#define SAMPLE (6 * ONE_HOUR)
+/* how much the known range grows at a time */
+#define GROW (366 * ONE_DAY)
+/* the ends of time for a zone read from a file, far enough to add offsets */
+#define TIME_LOW (-((time_t)1 << 60))
+#define TIME_HIGH ((time_t)1 << 60)
+
+#define TZ_DIR "/usr/share/zoneinfo"
+#define LOCALTIME "/etc/localtime"
+#define TZIF_HEADER 44
+
+static time_t floor_div(time_t a, time_t b)
+{
+    return a / b - (a % b < 0);
+}
+
+static time_t floor_mod(time_t a, time_t b)
+{
+    return a - floor_div(a, b) * b;
+}
+
+/* days since 1970-01-01 of a proleptic Gregorian date, month 1-12 */
+static time_t days_from_civil(time_t y, int m, int d)
+{
+    time_t era;
+    long yoe, doy, doe;
+
+    y -= m <= 2;
+    era = floor_div(y, 400);
+    yoe = y - era * 400;
+    doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static void civil_from_days(time_t days, time_t *y, int *m, int *d)
+{
+    time_t era;
+    long doe, yoe, doy, mp;
+
+    days += 719468;
+    era = floor_div(days, 146097);
+    doe = days - era * 146097;
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = yoe + era * 400 + (*m <= 2);
+}
+
+/* gmtime_r() of wall clock seconds, without tm_isdst, tm_gmtoff and tm_zone */
+void clock__civil(time_t wall, struct tm *info)
+{
+    time_t days = floor_div(wall, ONE_DAY);
+    long secs = wall - days * ONE_DAY;
+    time_t y;
+    int m, d;
+
+    civil_from_days(days, &y, &m, &d);
+    memset(info, 0, sizeof(*info));
+    info->tm_year = y - 1900;
+    info->tm_mon = m - 1;
+    info->tm_mday = d;
+    info->tm_hour = secs / ONE_HOUR;
+    info->tm_min = secs / ONE_MIN % 60;
+    info->tm_sec = secs % ONE_MIN;
+    /* 1970-01-01 was a Thursday */
+    info->tm_wday = floor_mod(days + 4, 7);
+    info->tm_yday = days - days_from_civil(y, 1, 1);
+}
+
+/* timegm() of info, whose fields may be out of range like for mktime() */
+time_t clock__civil_secs(const struct tm *info)
+{
+    time_t y = info->tm_year + 1900 + floor_div(info->tm_mon, 12);
+    int m = floor_mod(info->tm_mon, 12) + 1;
+
+    return (days_from_civil(y, m, 1) + info->tm_mday - 1) * ONE_DAY +
+           info->tm_hour * ONE_HOUR + info->tm_min * ONE_MIN + info->tm_sec;
+}
+
+/* the only calls into the tz code */
+static void tz_span(time_t t, struct clock_span *span)
+{
+    struct tm info;
+
+    localtime_r(&t, &info);
+    span->start = t;
+    span->off = info.tm_gmtoff;
+    span->isdst = info.tm_isdst > 0;
+}
+
+/* first second in (a, b] with the offset of b, the one at a being different */
+static time_t tz_bisect(time_t a, time_t b, long off)
+{
+    while (b - a > 1) {
+        time_t mid = a + (b - a) / 2;
+        struct clock_span span;
+
+        tz_span(mid, &span);
+        if (span.off == off)
+            b = mid;
+        else
+            a = mid;
+    }
+    return b;
+}
+
+static struct clock_span *clock__last(struct clock_zone *zone)
+{
+    return __vec__at(zone->spans, vec__len_st(zone->spans) - 1);
+}
+
+/* adds span unless the last one has the same offset */
+static int clock__push(struct clock_zone *zone, const struct clock_span *span)
+{
+    struct clock_span *last = vec__is_empty(zone->spans) ? NULL : clock__last(zone);
+
+    if (last && last->off == span->off && last->isdst == span->isdst)
+        return 0;
+    return __vec__push(zone->spans, (void *)span, sizeof(*span));
+}
+
+/* samples the offsets from the end of the known range up to at least hi */
+static int clock__sample(struct clock_zone *zone, time_t hi)
+{
+    time_t t = zone->hi - 1;
+
+    while (t < hi) {
+        struct clock_span span;
+        long off = clock__last(zone)->off;
+
+        t += SAMPLE;
+        tz_span(t, &span);
+        if (span.off != off)
+            span.start = tz_bisect(t - SAMPLE, t, span.off);
+        if (clock__push(zone, &span))
+            return -1;
+    }
+    zone->hi = t + 1;
+    return 0;
+}
+
+/* starts over with a known range from a while before t */
+static int clock__reset(struct clock_zone *zone, time_t t)
+{
+    struct clock_span span;
+    time_t hi = zone->hi > t ? zone->hi : t + GROW;
+
+    vec__resize(zone->spans, 0);
+    zone->lo = t - GROW;
+    zone->hi = zone->lo + 1;
+    zone->hint = 0;
+    tz_span(zone->lo, &span);
+    if (clock__push(zone, &span))
+        return -1;
+    return clock__sample(zone, hi);
+}
+
+/* the day since the epoch a rule date falls on in year y */
+static time_t rule_day(const struct clock_rule_date *date, time_t y)
+{
+    bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+    time_t first, next, day;
+
+    if (date->kind == 'J')
+        return days_from_civil(y, 1, 1) + date->day - 1 + (leap && date->day >= 60);
+    if (date->kind == 'D')
+        return days_from_civil(y, 1, 1) + date->day;
+
+    /* the week-th such weekday of the month, week 5 is the last one */
+    first = days_from_civil(y, date->month, 1);
+    next = date->month == 12 ? days_from_civil(y + 1, 1, 1) : days_from_civil(y, date->month + 1, 1);
+    day = first + floor_mod(date->day - floor_mod(first + 4, 7), 7) + (date->week - 1) * 7;
+    while (day >= next)
+        day -= 7;
+    return day;
+}
+
+/* adds the rule's transitions a year at a time until the range reaches hi */
+static int clock__extend_rule(struct clock_zone *zone, time_t hi)
+{
+    const struct clock_rule *rule = &zone->rule;
+
+    while (zone->hi <= hi) {
+        time_t y = zone->rule_year++;
+        time_t next;
+        struct clock_span spans[2] = {
+            { rule_day(&rule->start, y) * ONE_DAY + rule->start.time - rule->std_off,
+              rule->dst_off, 1 },
+            { rule_day(&rule->end, y) * ONE_DAY + rule->end.time - rule->dst_off,
+              rule->std_off, 0 },
+        };
+        /* DST spans the new year in the southern hemisphere */
+        int first = spans[1].start < spans[0].start;
+
+        for (int i = 0; i < 2; i++) {
+            const struct clock_span *span = &spans[first ^ i];
+
+            if (span->start > clock__last(zone)->start && clock__push(zone, span))
+                return -1;
+        }
+        /* a rule time is at most a week away from its day */
+        next = (days_from_civil(y + 1, 1, 1) - 8) * ONE_DAY;
+        if (next > zone->hi)
+            zone->hi = next;
+    }
+    return 0;
+}
+
+/* a zone abbreviation, alphabetic or quoted in <> */
+static const char *rule_name(const char *s)
+{
+    const char *start = s;
+
+    if (*s == '<') {
+        s = strchr(s, '>');
+        return s ? s + 1 : NULL;
+    }
+    while (isalpha((unsigned char)*s))
+        ++s;
+    return s - start >= 3 ? s : NULL;
+}
+
+/* [+-]hh[:mm[:ss]] */
+static const char *rule_time(const char *s, long *secs)
+{
+    int sign = 1;
+    long part[3] = { 0, 0, 0 };
+
+    if (*s == '+' || *s == '-')
+        sign = *s++ == '-' ? -1 : 1;
+    for (int i = 0; i < 3; i++) {
+        char *end;
+
+        if (!isdigit((unsigned char)*s))
+            return NULL;
+        part[i] = strtol(s, &end, 10);
+        s = end;
+        if (*s != ':')
+            break;
+        ++s;
+    }
+    *secs = sign * (part[0] * ONE_HOUR + part[1] * ONE_MIN + part[2]);
+    return s;
+}
+
+/* Jn, n or Mm.w.d, optionally followed by /time */
+static const char *rule_date(const char *s, struct clock_rule_date *date)
+{
+    char *end;
+
+    date->time = 2 * ONE_HOUR;
+    if (*s == 'M') {
+        date->kind = 'M';
+        if (sscanf(s, "M%d.%d.%d", &date->month, &date->week, &date->day) != 3 ||
+            date->month < 1 || date->month > 12 || date->week < 1 || date->week > 5 ||
+            date->day < 0 || date->day > 6)
+            return NULL;
+        s = strchr(strchr(s, '.') + 1, '.') + 1;
+        while (isdigit((unsigned char)*s))
+            ++s;
+    } else {
+        date->kind = *s == 'J' ? 'J' : 'D';
+        s += *s == 'J';
+        if (!isdigit((unsigned char)*s))
+            return NULL;
+        date->day = strtol(s, &end, 10);
+        s = end;
+        if (date->day > 365 || (date->kind == 'J' && date->day < 1))
+            return NULL;
+    }
+    if (*s == '/')
+        s = rule_time(s + 1, &date->time);
+    return s;
+}
+
+/* std offset [dst [offset] [,start[/time],end[/time]]] */
+static int clock__parse_rule(const char *s, struct clock_rule *rule)
+{
+    long off;
+
+    memset(rule, 0, sizeof(*rule));
+    if (!(s = rule_name(s)) || !(s = rule_time(s, &off)))
+        return -1;
+    /* POSIX offsets count west of UTC */
+    rule->std_off = -off;
+    if (!*s)
+        return 0;
+
+    if (!(s = rule_name(s)))
+        return -1;
+    rule->dst_off = rule->std_off + ONE_HOUR;
+    if (*s && *s != ',') {
+        if (!(s = rule_time(s, &off)))
+            return -1;
+        rule->dst_off = -off;
+    }
+    if (!*s) {
+        /* the US rules, like the tz code without a rule */
+        s = ",M3.2.0,M11.1.0";
+    }
+    if (*s != ',' || !(s = rule_date(s + 1, &rule->start)) ||
+        *s != ',' || !(s = rule_date(s + 1, &rule->end)) || *s)
+        return -1;
+    rule->has_dst = true;
+    return 0;
+}
+
+static int64_t be(const unsigned char *p, int size)
+{
+    uint64_t v = 0;
+
+    for (int i = 0; i < size; i++)
+        v = v << 8 | p[i];
+    /* sign extend a 32 bit time */
+    return size == 4 ? (int32_t)v : (int64_t)v;
+}
+
+/* the counts of a TZif header, NULL if it isn't one */
+static const unsigned char *tzif_header(const unsigned char *p, const unsigned char *end,
+                                        uint32_t cnt[6])
+{
+    if (end - p < TZIF_HEADER || memcmp(p, "TZif", 4))
+        return NULL;
+    for (int i = 0; i < 6; i++)
+        cnt[i] = be(p + 20 + i * 4, 4);
+    return p + TZIF_HEADER;
+}
+
+/*
+ * A TZif file (RFC 8536). The 64 bit data of version 2 and later is used
+ * where there is one, the rule of its footer covers the times after the
+ * last transition.
+ */
+static int clock__tzif(struct clock_zone *zone, const unsigned char *data, size_t len)
+{
+    enum { ISUT, ISSTD, LEAP, TIME, TYPE, CHAR };
+    const unsigned char *end = data + len;
+    const unsigned char *p, *times, *idx, *types;
+    uint32_t cnt[6];
+    int size = 4;
+    size_t body;
+    struct clock_span span;
+
+    if (!(p = tzif_header(data, end, cnt)))
+        return -1;
+    body = cnt[TIME] * 5 + cnt[TYPE] * 6 + cnt[CHAR] + cnt[LEAP] * 8 + cnt[ISSTD] + cnt[ISUT];
+    if (data[4] >= '2') {
+        if ((size_t)(end - p) < body || !(p = tzif_header(p + body, end, cnt)))
+            return -1;
+        size = 8;
+        body = cnt[TIME] * 9 + cnt[TYPE] * 6 + cnt[CHAR] + cnt[LEAP] * 12 + cnt[ISSTD] + cnt[ISUT];
+    }
+    if ((size_t)(end - p) < body || !cnt[TYPE])
+        return -1;
+    times = p;
+    idx = times + cnt[TIME] * size;
+    types = idx + cnt[TIME];
+
+    /* the first type holds before the first transition */
+    span = (struct clock_span){ TIME_LOW, (int32_t)be(types, 4), types[4] };
+    if (clock__push(zone, &span))
+        return -1;
+    for (uint32_t i = 0; i < cnt[TIME]; i++) {
+        const unsigned char *type;
+
+        if (idx[i] >= cnt[TYPE])
+            return -1;
+        type = types + idx[i] * 6;
+        span = (struct clock_span){ be(times + i * size, size), (int32_t)be(type, 4), type[4] };
+        if (clock__push(zone, &span))
+            return -1;
+    }
+    zone->hi = clock__last(zone)->start + 1;
+
+    /* the footer is a POSIX TZ string between newlines */
+    p += body;
+    if (size == 8 && end - p > 2 && *p == '\n' && end[-1] == '\n') {
+        char rule[128];
+
+        snprintf(rule, sizeof(rule), "%.*s", (int)(end - p - 2), p + 1);
+        if (!clock__parse_rule(rule, &zone->rule) && zone->rule.has_dst) {
+            time_t y;
+            int m, d;
+
+            civil_from_days(floor_div(clock__last(zone)->start, ONE_DAY), &y, &m, &d);
+            zone->has_rule = true;
+            zone->rule_year = y;
+        }
+    }
+    if (!zone->has_rule)
+        zone->hi = TIME_HIGH;
+    return 0;
+}
+
+int clock__init(struct clock_zone *zone)
+{
+    memset(zone, 0, sizeof(*zone));
+    zone->spans = vec__new(sizeof(struct clock_span));
+    return zone->spans ? 0 : -1;
+}
+
+/*
+ * A zone by name, a file under $TZDIR or /usr/share/zoneinfo or else a
+ * POSIX TZ string. -1 if it is neither.
+ */
+int clock__load(struct clock_zone *zone, const char *name)
+{
+    char path[PATH_MAX];
+    const char *dir = getenv("TZDIR");
+    struct file_map map;
+    int err;
+
+    if (clock__init(zone))
+        return -1;
+    zone->name = strdup(name);
+    if (!zone->name)
+        goto err;
+    zone->lo = TIME_LOW;
+
+    if (*name == ':')
+        ++name;
+    if (*name == '/')
+        snprintf(path, sizeof(path), "%s", name);
+    else
+        snprintf(path, sizeof(path), "%s/%s", dir ? dir : TZ_DIR, name);
+    if (*name && !file__map(path, &map)) {
+        err = clock__tzif(zone, (const unsigned char *)map.data, map.len);
+        file__unmap(&map);
+    } else if (!(err = clock__parse_rule(name, &zone->rule))) {
+        struct clock_span span = { TIME_LOW, zone->rule.std_off, 0 };
+
+        err = clock__push(zone, &span);
+        zone->has_rule = zone->rule.has_dst;
+        zone->rule_year = 1970;
+        zone->hi = zone->has_rule ? TIME_LOW + 1 : TIME_HIGH;
+    }
+    if (err)
+        goto err;
+    return 0;
+err:
+    clock__free(zone);
+    return -1;
+}
+
+void clock__free(struct clock_zone *zone)
+{
+    vec__free(zone->spans);
+    free(zone->name);
+    zone->spans = NULL;
+    zone->name = NULL;
+}
+
+static struct clock_zone local;
+
+/* the zone of the process, set up on first use */
+struct clock_zone *clock__local_zone(void)
+{
+    if (!local.spans && clock__init(&local))
+        return NULL;
+    return &local;
+}
+
+/* what the process' zone comes from, TZ or else /etc/localtime */
+struct clock_source {
+    char tz[PATH_MAX];
+    bool has_tz;
+    struct stat file;
+    bool has_file;
+};
+
+static void clock__source(struct clock_source *src)
+{
+    const char *tz = getenv("TZ");
+
+    memset(src, 0, sizeof(*src));
+    src->has_tz = tz;
+    if (tz)
+        snprintf(src->tz, sizeof(src->tz), "%s", tz);
+    src->has_file = !stat(LOCALTIME, &src->file);
+}
+
+/*
+ * Whether the process' zone changed since the last call, through TZ or a
+ * new /etc/localtime. The tz code is told and the offsets learnt so far
+ * are dropped then, times computed with them are off. The first call only
+ * takes note.
+ */
+bool clock__local_changed(void)
+{
+    static struct clock_source last;
+    static bool known;
+    struct clock_source now;
+    bool changed;
+
+    clock__source(&now);
+    changed = known &&
+        (now.has_tz != last.has_tz || strcmp(now.tz, last.tz) ||
+         now.has_file != last.has_file ||
+         (now.has_file && (now.file.st_ino != last.file.st_ino ||
+                           now.file.st_dev != last.file.st_dev ||
+                           now.file.st_mtime != last.file.st_mtime ||
+                           now.file.st_size != last.file.st_size)));
+    last = now;
+    known = true;
+    if (!changed)
+        return false;
+    tzset();
+    if (local.spans)
+        vec__resize(local.spans, 0);
+    return true;
+}
+
+/*
+ * The index of the span t falls into. The range only grows, so a failed
+ * allocation leaves the last known offset in place, which is wrong at
+ * worst across a transition.
+ */
+static size_t clock__find(struct clock_zone *zone, time_t t)
+{
+    struct clock_span *spans;
+    size_t lo, hi;
+
+    if (vec__is_empty(zone->spans) || t < zone->lo)
+        clock__reset(zone, t);
+    else if (t >= zone->hi && zone->name)
+        clock__extend_rule(zone, t + GROW);
+    else if (t >= zone->hi)
+        clock__sample(zone, t + GROW);
+
+    spans = __vec__at(zone->spans, 0);
+    hi = vec__len_st(zone->spans);
+    /* the times asked for mostly move forward a little */
+    if (spans[zone->hint].start <= t &&
+        (zone->hint + 1 == hi || t < spans[zone->hint + 1].start))
+        return zone->hint;
+
+    lo = 0;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (spans[mid].start <= t)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    zone->hint = lo;
+    return lo;
+}
+
+void clock__range(struct clock_zone *zone, time_t t, struct clock_range *range)
+{
+    size_t i = clock__find(zone, t);
+    const struct clock_span *spans = __vec__at(zone->spans, 0);
+
+    range->start = spans[i].start;
+    range->off = spans[i].off;
+    range->prev_off = i ? spans[i - 1].off : spans[i].off;
+    range->end = i + 1 < vec__len_st(zone->spans) ? spans[i + 1].start : zone->hi;
+}
+
+/* localtime_r() of t in zone, without tm_zone */
+void clock__local(struct clock_zone *zone, time_t t, struct tm *info)
+{
+    const struct clock_span *span = __vec__at(zone->spans, clock__find(zone, t));
+
+    clock__civil(t + span->off, info);
+    info->tm_isdst = span->isdst;
+    info->tm_gmtoff = span->off;
+}
@@ -0,0 +1,69 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/* a stretch of time with one UTC offset, until the start of the next one */
+struct clock_span {
+    time_t start;
+    long off; /* seconds east of UTC */
+    int isdst;
+};
+
+/* the day of the year a POSIX TZ rule switches on, and the local time */
+struct clock_rule_date {
+    char kind; /* 'J' Julian day 1-365, 'D' day 0-365, 'M' month.week.weekday */
+    int month;
+    int week;
+    int day;
+    long time;
+};
+
+/* a POSIX TZ string like EST5EDT,M3.2.0,M11.1.0 */
+struct clock_rule {
+    long std_off;
+    long dst_off;
+    bool has_dst;
+    struct clock_rule_date start; /* of DST, in standard time */
+    struct clock_rule_date end; /* of DST, in DST */
+};
+
+/*
+ * The UTC offsets of a time zone over the range [lo, hi), used to convert
+ * between time_t and broken-down time with plain arithmetic. The process'
+ * zone learns them from the tz code, a named zone from its TZif file and
+ * the rule at its end. The range grows when a time outside of it is asked
+ * for. Not thread safe, a zone belongs to one thread.
+ */
+struct clock_zone {
+    struct clock_span *spans; /* vector, sorted by start */
+    time_t lo;
+    time_t hi;
+    size_t hint; /* the span of the last lookup */
+    char *name; /* NULL for the process' zone */
+    bool has_rule;
+    struct clock_rule rule; /* after the last transition of the file */
+    time_t rule_year; /* the next year to add the rule's transitions of */
+};
+
+/* the span around a time, with the offset in effect before it */
+struct clock_range {
+    time_t start;
+    time_t end; /* the next span starts here, or the known range ends */
+    long off;
+    long prev_off;
+};
+
+int clock__init(struct clock_zone *zone);
+int clock__load(struct clock_zone *zone, const char *name);
+void clock__free(struct clock_zone *zone);
+struct clock_zone *clock__local_zone(void);
+bool clock__local_changed(void);
+void clock__range(struct clock_zone *zone, time_t t, struct clock_range *range);
+void clock__local(struct clock_zone *zone, time_t t, struct tm *info);
+void clock__civil(time_t wall, struct tm *info);
+time_t clock__civil_secs(const struct tm *info);
+
+#endif
@@ -2,820 +2,452 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <errno.h>
 #include <unistd.h>
 #include <time.h>
 #include <stdbool.h>
-
-#if defined(__APPLE__) || defined(__MACH__)
 #include <limits.h> /* PATH_MAX */
-#endif
+#include <poll.h>
+#include <getopt.h>
+#include <signal.h>
 
 #include "util.h"
 #include "file.h"
 #include "vec.h"
-#include "atoin.h"
-
-#define CRON_NUM 5
-#define TOK_LEN 1024
-#define MAX_ARG 128
-#define ARG_LEN 256
-#define COMM_LEN 1024
-#define ONE_SEC 1
-#define MAX_SCHED 61
-
-#define MIN_MINUTE 0
-#define MAX_MINUTE 59
-#define MIN_HOUR 0
-#define MAX_HOUR 23
-#define MIN_DAY_OF_MONTH 1
-#define MAX_DAY_OF_MONTH 31
-#define MIN_MONTH 1
-#define MAX_MONTH 12
-#define MIN_DAY_OF_WEEK 1
-#define MAX_DAY_OF_WEEK 7
-
-#define MIN_STEP 1
+#include "cron.h"
+#include "engine.h"
+#include "child.h"
+#include "launch.h"
+#include "tab.h"
+#include "cache.h"
+#include "sim.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#define MAX_SLEEP 60
 
 #define HOME "HOME"
 #define DEFAULT_CRONTAB_FMT "%s/.crontab.txt"
+#define CACHE_FMT "%s.cache"
 
-/* stands for start, end, step */
-typedef struct Ses {
-    /*
-     * start and end act as temporary variables for parsing,
-     * do not represent the real start and end
-     */
-    // maybe now it does mean something... start == end == -1
-    // means it's *
-    int start;
-    int end;
-    int count;
-    char sched[MAX_SCHED];
-} Ses;
-
-typedef struct cron_set {
-    Ses minute;
-    Ses hour;
-    Ses day_of_month;
-    Ses month;
-    Ses day_of_week;
-} cron_set;
-
-/* if no next token, set tok to NULL, and return 0 */
-static int get_next_tok(char **pos, char *tok, int tok_size)
+/*
+ * Waits until the wall clock reaches t (forever if t is -1) or one of the
+ * fds becomes readable, waking up at least every MAX_SLEEP seconds so that
+ * clock adjustments and a new local time zone are noticed
+ */
+static void cron__wait_until(time_t t, struct pollfd *pfds, nfds_t n)
 {
-    char *start, *end;
-    size_t num;
+    time_t now = time(NULL);
+    int timeout = MAX_SLEEP * 1000;
 
-    if (!pos || !tok) {
-        pr_err("Some of get_next_tok's pointers are NULL\n");
-        return -1;
+    if (t != -1) {
+        if (t <= now)
+            return;
+        timeout = min(t - now, MAX_SLEEP) * 1000;
     }
-
-    /* find the first occurence of non-space */
-    for (start = *pos; *start && *start == ' '; ++start) {}
-    /* move till the first space */
-    for (end = start; *end && *end != ' '; ++end) {}
-
-    num = min(tok_size - 1, end - start);
-    strncpy(tok, start, num);
-    tok[num] = '\0';
-    *pos = end;
-    return num;
-}
-
-int check_bound(const int mn, const int mx, const int val)
-{
-    if (mn <= val && val <= mx)
-        return 1;
-    return 0;
+    poll(pfds, n, timeout);
 }
 
-bool is_astr(const Ses *ses)
+/* everything the scheduling loop works on */
+struct cron_ctx {
+    const char *path; /* of the crontab */
+    struct cron_tab tab;
+    const struct engine *engine;
+    const struct launcher *launcher;
+    void *sched;
+    struct children children;
+    size_t *run_queue; /* vector of job ids waiting for a free slot, oldest first */
+    size_t max_concurrent; /* 0 means no limit */
+    int watch_fd; /* inotify fd watching the crontab, -1 without one */
+};
+
+static void cron__launch(struct cron_ctx *ctx, size_t id)
 {
-    return ses->start == -1 && ses->end == -1;
+    cron_job *job = __vec__at(ctx->tab.jobs, id);
+    struct launch_attr attr = {
+        .sigmask = &ctx->children.oldmask,
+        .envp = job->envp,
+    };
+    pid_t pid;
+
+    pid = ctx->launcher->launch(job->argv, &attr);
+    if (pid == -1)
+        return;
+    if (children__add(&ctx->children, pid, id)) {
+        pr_err("Failed to track the child of line %d\n", job->line);
+        return;
+    }
+    ++((struct cron_run *)__vec__at(ctx->tab.runs, id))->running;
 }
 
 /*
- * Returns a positive number when cron should exec
+ * Starts queued jobs in order as long as there are free slots. A job held
+ * back by its own limit keeps its place without blocking the ones after it.
  */
-static int cron__should_exec(cron_set *crn_s)
+static void cron__dispatch(struct cron_ctx *ctx)
 {
-    /* minute, hour, day of month, month, day of week */
-    time_t raw_time;
-    struct tm *info;
-    /* time of the previous check */
-    static int prev_check_min = -1;
-    static int prev_check_hour = -1;
-    static int prev_check_mday = -1;
-    static int prev_check_mon = -1;
-    static int prev_check_wday = -1;
-    int min;
-    int hour;
-    int mday;
-    int mon;
-    int wday;
-
-    if (!crn_s)
-        return 0;
+    size_t len = vec__len_st(ctx->run_queue);
+    size_t *queue = __vec__at(ctx->run_queue, 0);
+    size_t kept = 0;
+    size_t i;
 
-#ifdef DEBUG
-    static int debug_timer_init = 1;
-    static time_t debug_timer;
+    for (i = 0; i < len; i++) {
+        cron_job *job = __vec__at(ctx->tab.jobs, queue[i]);
+        struct cron_run *run = __vec__at(ctx->tab.runs, queue[i]);
 
-    if (debug_timer_init) {
-        debug_timer_init = 0;
-        time(&debug_timer);
-    } else {
-        debug_timer += 30; /* force addition */
-    }
-
-    info = localtime(&debug_timer);
-    min = info->tm_min;
-    hour = info->tm_hour;
-    mday = info->tm_mday;
-    mon = info->tm_mon + 1;
-    wday = info->tm_wday + 1;
-#else
-    time(&raw_time);
-    info = localtime(&raw_time);
-
-    min = info->tm_min;
-    hour = info->tm_hour;
-    mday = info->tm_mday;
-    mon = info->tm_mon + 1;
-    wday = info->tm_wday + 1;
-#endif /* DEBUG */
-
-    /* we already checked this */
-    if (min == prev_check_min && hour == prev_check_hour && mday == prev_check_mday &&
-        mon == prev_check_mon && wday == prev_check_wday)
-        return 0;
-
-    prev_check_min = min;
-    prev_check_mday = mday;
-    prev_check_hour = hour;
-    prev_check_mon = mon;
-    prev_check_wday = wday;
-
-    pr_debug("\n%d:%d %d/%d wday: %d\n", hour, min, mon, mday, wday);
-
-    /*
-     * 1. If month, day of month, and day of week are all <asterisk> characters,
-     *    every day shall be matched.
-     *
-     * 2. month=elem/list or mday=elem/list, wday *, month and mday determines
-     *
-     * 3. month and mday both*, wday=elem/list, wday determines
-     *
-     * 4. If either month or mday is elem/list, wday is elem/list, any day either
-     *    the month and day of month, or day of week shall match
-     */
-    if (is_astr(&crn_s->month) && is_astr(&crn_s->day_of_month) &&
-        is_astr(&crn_s->day_of_week)) {
-        // legal, so don't do anything, only return when negative condition
-        // is met
-    } else if ((!is_astr(&crn_s->month) || !is_astr(&crn_s->day_of_month)) &&
-               is_astr(&crn_s->day_of_week)) {
-        // negative
-        if (!is_astr(&crn_s->month) && check_bound(MIN_MONTH, MAX_MONTH, mon) &&
-            !crn_s->month.sched[mon]) {
-            return 0;
-        }
-        if (!is_astr(&crn_s->day_of_month) && check_bound(MIN_DAY_OF_MONTH, MAX_DAY_OF_MONTH, mday) &&
-            !crn_s->day_of_month.sched[mday]) {
-            return 0;
+        if (ctx->max_concurrent &&
+            children__running(&ctx->children) >= ctx->max_concurrent)
+            break;
+        if (job->max_running && run->running >= job->max_running) {
+            queue[kept++] = queue[i];
+            continue;
         }
-    } else if (is_astr(&crn_s->month) && is_astr(&crn_s->day_of_month) &&
-               !is_astr(&crn_s->day_of_week)) {
-        if (check_bound(MIN_DAY_OF_WEEK, MAX_DAY_OF_WEEK, wday) &&
-            !crn_s->day_of_week.sched[wday])
-            return 0;
-    } else if ((!is_astr(&crn_s->month) || !is_astr(&crn_s->day_of_month)) &&
-               !is_astr(&crn_s->day_of_week)) {
-        // !((mday && month) || (wday))
-        //   = !(mday && month) && !wday
-        //   = (!mday || !month) && !wday
-        bool mday_ret = check_bound(MIN_DAY_OF_MONTH, MAX_DAY_OF_MONTH, mday) && crn_s->day_of_month.sched[mday];
-        bool mon_ret = check_bound(MIN_MONTH, MAX_MONTH, mon) && crn_s->month.sched[mon];
-        bool wday_ret = check_bound(MIN_DAY_OF_WEEK, MAX_DAY_OF_WEEK, wday) && crn_s->day_of_week.sched[wday];
-        if ((!mday_ret || !mon_ret) && !wday_ret)
-            return 0;
-    } else {
-        pr_err("Invalid month + wday + mday combination\n");
+        run->queued = false;
+        cron__launch(ctx, queue[i]);
     }
-
-    if (check_bound(MIN_HOUR, MAX_HOUR, hour) &&
-        !crn_s->hour.sched[hour])
-        return 0;
-
-    if (check_bound(MIN_MINUTE, MAX_MINUTE, min) &&
-        !crn_s->minute.sched[min])
-        return 0;
-
-    pr_debug("Valid timestamp\n");
-    return 1;
+    memmove(queue + kept, queue + i, (len - i) * sizeof(*queue));
+    vec__resize(ctx->run_queue, kept + len - i);
 }
 
-static int get_next_arg(char **pos, char *arg, int arg_size)
+/*
+ * A due job goes to the back of the run queue. The queue holds each job at
+ * most once, a job that fires again while still waiting is skipped, so it
+ * never grows beyond the number of jobs.
+ */
+static int cron__enqueue(struct cron_ctx *ctx, size_t id)
 {
-    /*
-    // for every occurence of space, one need to consume all of them
-    $root
-        (" | char | ' ')
-        $":
-            (" | ANY OTHER THAN '"')
-            $":
-                (root | end)
-            $ANY OTHER THAN '"':
-                (")
-                    $":
-                        (end)
-        $char:
-            (' ' | end)
-            $' ':
-                (root)
-        $' '
-            (root)
-    */
-    char sep;
-    char *end = NULL;
-
-    if (!pos || !*pos || !**pos)
-        return -1;
+    struct cron_run *run = __vec__at(ctx->tab.runs, id);
 
-    /* allows multiple spaces, go to the first non-space character */
-    end = *pos;
-    while(*end && *end == ' ')
-        ++end;
-    if (!*end)
-        return -1;
-    *pos = end;
-
-    if (**pos == '"') {
-        sep = '"';
-        ++*pos;
-    } else if (**pos == '\'') {
-        sep = '\'';
-        ++*pos;
-    } else {
-        sep = ' ';
+    if (run->queued) {
+        pr_err("Line %d is still waiting for a free slot, skipping a run\n",
+               ((cron_job *)__vec__at(ctx->tab.jobs, id))->line);
+        return 0;
     }
+    if (__vec__push(ctx->run_queue, &id, sizeof(id)))
+        return -1;
+    run->queued = true;
+    return 0;
+}
 
-    if (**pos) {
-        int siz = 0;
-        end = *pos;
-
-        while (*end && *end != sep)
-            ++end;
-        if (sep == '"' && !*end) /* hits the end without the matching " */
-            return -1;
-        if (sep == '\'' && !*end)
-            return -1;
-
-        siz = min(end - *pos, arg_size - 1);
-        strncpy(arg, *pos, siz);
-        arg[siz] = '\0';
-        if (sep == '"')
-            *pos = end + 1;
-        else if (sep == '\'')
-            *pos = end + 1;
-        else
-            *pos = end;
-        return 0;
+/*
+ * Watches the directory of the crontab rather than the file, editors that
+ * save by renaming a new file over the old one would leave a watch on the
+ * file behind on the old inode. Returns -1 where inotify is missing.
+ */
+static int cron__watch(const char *path)
+{
+#ifdef __linux__
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    int fd;
+
+    if (!slash)
+        strcpy(dir, ".");
+    else
+        snprintf(dir, sizeof(dir), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1)
+        goto err;
+    if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        close(fd);
+        goto err;
     }
+    return fd;
+err:
+    perror("Not watching the crontab for changes");
+#else
+    (void)path;
+#endif /* __linux__ */
     return -1;
 }
 
-static void exec(char *comm_args)
+/* drains the pending events, true if one of them is about the crontab */
+static bool cron__watch_changed(int fd, const char *path)
 {
-    int pid;
-
-    pid = fork();
-    if (pid == -1) {
-        pr_err("Failed to fork\n");
-        return;
-    } else if (pid == 0) {
-        char *args[MAX_ARG] = { NULL }; /* not the safest */
-        char arg[ARG_LEN] = { 0 };
-        char comm_strip[COMM_LEN] = { 0 };
-        char *pos = comm_args;
-        int idx = 0;
-
-        while(idx < MAX_ARG - 1 && !get_next_arg(&pos, arg, sizeof(arg))) {
-            if (idx == 0) // command
-                strncpy(comm_strip, arg, ARG_LEN);
-
-            args[idx] = malloc(ARG_LEN);
-            if (args[idx] == NULL) {
-                pr_err("Failed to allocate argument buffer\n");
-                goto out_free;
-            }
-
-            strncpy(args[idx], arg, ARG_LEN);
-            pr_debug("arg[%d] = %s\n", idx, arg);
-            memset(arg, 0, ARG_LEN);
-            ++idx;
-        }
-        args[idx] = NULL;
-
-        pr_debug("Command: %s\n", comm_strip);
-        pr_debug("Arguments: [");
-        for (int i = 0; i < idx; ++i) {
-            if (i < idx - 1)
-                pr_debug("'%s', ", args[i]);
-            else
-                pr_debug("'%s'", args[i]);
+    bool changed = false;
+#ifdef __linux__
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const char *name = strrchr(path, '/');
+    ssize_t len;
+
+    name = name ? name + 1 : path;
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+
+            if (ev->len && !strcmp(ev->name, name))
+                changed = true;
+            p += sizeof(*ev) + ev->len;
         }
-        pr_debug("]\n");
-        execvp(comm_strip, args);
-        perror("execvp");
-out_free:
-        for (int i = 0; i < MAX_ARG; ++i)
-            free(args[i]);
-        exit(-1);
-    } else {
-        waitpid(pid, NULL, 0);
     }
+#else
+    (void)fd;
+    (void)path;
+#endif /* __linux__ */
+    return changed;
 }
 
-static int cron__sched(cron_set *crn_s, char *comm_args)
+/*
+ * Brings the engine and the run queue in line with the last load of the
+ * crontab, only the jobs it added or removed are touched
+ */
+static int cron__apply(struct cron_ctx *ctx, time_t now)
 {
-    if (crn_s == NULL)
-        return -1;
+    struct cron_tab *tab = &ctx->tab;
+    size_t len = vec__len_st(ctx->run_queue);
+    size_t *queue = __vec__at(ctx->run_queue, 0);
+    size_t kept = 0;
+
+    for (size_t i = 0; i < vec__len_st(tab->shares.removed); i++)
+        ctx->engine->remove(ctx->sched, *(size_t *)__vec__at(tab->shares.removed, i));
+    if (!vec__is_empty(tab->removed)) {
+        for (size_t i = 0; i < len; i++) {
+            cron_job *job = __vec__at(tab->jobs, queue[i]);
+
+            if (!job->dead)
+                queue[kept++] = queue[i];
+        }
+        vec__resize(ctx->run_queue, kept);
+    }
 
-    while (1) {
-        if (cron__should_exec(crn_s))
-            exec(comm_args);
-#ifdef DEBUG
-#define DEBUG_US 200 * 1000
-        usleep(DEBUG_US);
-#else
-        sleep(ONE_SEC);
-#endif
+    /* a job with the schedule of one loaded before joins its share */
+    for (size_t i = 0; i < vec__len_st(tab->shares.added); i++) {
+        size_t id = *(size_t *)__vec__at(tab->shares.added, i);
+        struct share *share = __vec__at(tab->shares.shares, id);
+        const cron_set *crn_s = __vec__at(tab->shares.sets, id);
+
+        share->next = cron_next_fire(crn_s, share->zone, now);
+        if (share->next != -1 &&
+            ctx->engine->add(ctx->sched, share->next, id, crn_s, share->zone))
+            return -1;
     }
     return 0;
 }
 
-static char zero[] = "0";
-static int is_legal(int tmp, char *pos, size_t n) {
-    return !(tmp == 0 && strncmp(pos, zero, min(sizeof(zero), n)));
-}
-
-static void ses__write_sched(Ses *ses, const int _start, const int _end, const int step)
+/*
+ * The process' zone changed, the fire times computed with its old offsets
+ * are wrong. Engines keep state per zone, so the engine starts over with
+ * every share.
+ */
+static int cron__rezone(struct cron_ctx *ctx, time_t now)
 {
-    const int start = max(0, _start);
-    const int end = min(MAX_SCHED - 1, (_end == -1 ? MAX_SCHED - 1 : _end));
+    struct share_tab *st = &ctx->tab.shares;
 
-    pr_debug("start %d end %d\n", _start, _end);
-    if (step < MIN_STEP) {
-        pr_err("step can't be %d\n", step);
-        return;
+    pr_err("The local time zone changed, rescheduling\n");
+    ctx->engine->free(ctx->sched);
+    ctx->sched = ctx->engine->new(now);
+    if (!ctx->sched)
+        return -1;
+    for (size_t id = 0; id < vec__len_st(st->shares); id++) {
+        struct share *share = __vec__at(st->shares, id);
+        const cron_set *crn_s = __vec__at(st->sets, id);
+
+        /* a free slot */
+        if (!share->jobs)
+            continue;
+        share->next = cron_next_fire(crn_s, share->zone, now);
+        if (share->next != -1 &&
+            ctx->engine->add(ctx->sched, share->next, id, crn_s, share->zone))
+            return -1;
     }
-    for (int i = start; i <= end; i += step)
-        ses->sched[i] = 1;
+    return 0;
 }
 
-static int parse_ses(char **pos, Ses *ses, int min_val, int max_val);
-
-static int parse_step(char **pos, Ses *ses)
+/* a crontab that can't be read right now keeps the jobs loaded before */
+static int cron__reload(struct cron_ctx *ctx, time_t now)
 {
-    int step;
-
-    if (isdigit(**pos)) { // step
-        char *end = NULL;
-        for(end = *pos; isdigit(*end) && *end; ++end) {}
-        step = atoin(*pos, end - *pos);
-        if (!is_legal(step, *pos, end - *pos)) {
-            pr_err("Can't be converted to integer\n");
-            return -1;
-        }
-        *pos = end;
-    } else {
-        pr_err("\'/\' should be followed with a number\n");
-        return -1;
-    }
-    if (step < MIN_STEP) {
-        pr_err("step can't be %d\n", step);
-        return -1;
+    struct file_map map;
+    int err;
+
+    if (file__map(ctx->path, &map)) {
+        perror("Failed to reopen the crontab file");
+        return 0;
     }
-    return step;
+    err = tab__load(&ctx->tab, map.data, map.len);
+    file__unmap(&map);
+    if (err)
+        return err;
+    return cron__apply(ctx, now);
 }
 
-static int parse_num_lhs(char **pos, Ses *ses, int min_val, int max_val)
+/*
+ * The engine orders the distinct schedules by their next fire time, the loop
+ * sleeps until the earliest one and only pops the ones that are due, each
+ * with all the jobs that share it. Jobs run in the
+ * background, the loop also wakes up to reap them when they exit, which
+ * frees slots for the jobs waiting in the run queue, and when the crontab
+ * changes.
+ */
+static int cron__sched(struct cron_ctx *ctx)
 {
-    char *end = NULL;
+    const struct engine *engine = ctx->engine;
+    struct pollfd pfds[2];
+    time_t now;
+    time_t due;
+    size_t id;
+    int status;
+    int popped;
+    int err = 0;
 
-    // consumes the number
-    for(end = *pos; isdigit(*end) && *end; ++end) {}
-    int tmp = atoin(*pos, end - *pos);
-    if (!is_legal(tmp, *pos, end - *pos)) {
-        pr_err("Can't be converted to integer\n");
-        return -1;
-    }
-    if (!check_bound(min_val, max_val, tmp)) {
-        pr_err("Value %d out of range [%d, %d]\n", tmp, min_val, max_val);
+    if (children__init(&ctx->children))
         return -1;
+    pfds[0] = (struct pollfd){ .fd = ctx->children.fd, .events = POLLIN };
+    /* poll() skips a negative fd */
+    pfds[1] = (struct pollfd){ .fd = ctx->watch_fd, .events = POLLIN };
+
+    now = time(NULL);
+    clock__local_changed();
+    ctx->sched = engine->new(now);
+    ctx->run_queue = vec__new(sizeof(size_t));
+    if (!ctx->sched || !ctx->run_queue || cron__apply(ctx, now)) {
+        err = -1;
+        goto out;
     }
-    *pos = end;
-    ses->start = tmp;
 
-    if (!**pos) {
-        ses__write_sched(ses, ses->start, ses->start, MIN_STEP);
-        return 0;
-    } else if (**pos == '-') {
-        ++*pos;
-        if (isdigit(**pos)) {
-            char *end = NULL;
-
-            for(end = *pos; isdigit(*end) && *end; ++end) {}
-            tmp = atoin(*pos, end - *pos);
-            if (!is_legal(tmp, *pos, end - *pos)) {
-                pr_err("Can't be converted to integer\n");
-                return -1;
-            }
-            if (!check_bound(min_val, max_val, tmp)) {
-                pr_err("Value %d out of range [%d, %d]\n", tmp, min_val, max_val);
-                return -1;
-            }
-            if (tmp < ses->start) {
-                pr_err("Range end %d is less than start %d\n", tmp, ses->start);
-                return -1;
-            }
-            *pos = end;
-            ses->end = tmp;
-
-            if (**pos == '/') {
-                int step;
-
-                ++*pos;
-                step = parse_step(pos, ses);
-                if (step == -1)
-                    return -1;
-                ses__write_sched(ses, ses->start, ses->end, step);
-
-                if (**pos == ',') {
-                    ++*pos;
-                    if (parse_ses(pos, ses, min_val, max_val))
-                        return -1;
-                } else if (**pos) {
-                    pr_err("Illegal character(%c)\n", **pos);
-                    pr_debug("Illegal char on line %d\n", __LINE__);
-                    return -1;
-                }
-            } else if (**pos == ',') {
-                ses__write_sched(ses, ses->start, ses->end, MIN_STEP);
-                ++*pos;
-                if (parse_ses(pos, ses, min_val, max_val))
-                    return -1;
-            } else if (!**pos) {
-                ses__write_sched(ses, ses->start, ses->end, MIN_STEP);
-                return 0;
-            } else {
-                pr_err("Illegal character(%c)\n", **pos);
-                pr_debug("Illegal char on line %d\n", __LINE__);
-                return -1;
-            }
-        } else if (**pos == '*') {
-            ++*pos;
-            ses->end = -1;
-            if (**pos == '/') {
-                int step;
-
-                ++*pos;
-                step = parse_step(pos, ses);
-                if (step == -1)
-                    return -1;
-                ses__write_sched(ses, ses->start, ses->end, step);
-
-                if (**pos == ',') {
-                    ++*pos;
-                    if (parse_ses(pos, ses, min_val, max_val))
-                        return -1;
-                } else if (**pos) {
-                    pr_err("Illegal character(%c)\n", **pos);
-                    pr_debug("Illegal char on line %d\n", __LINE__);
-                    return -1;
-                }
-            } else if (!**pos) {
-                ses__write_sched(ses, ses->start, ses->end, MIN_STEP);
-                return 0;
-            } else if (**pos == ',') {
-                ses__write_sched(ses, ses->start, ses->end, MIN_STEP);
-                ++*pos;
-                if (parse_ses(pos, ses, min_val, max_val))
-                    return -1;
-            } else {
-                pr_err("Illegal character(%c)\n", **pos);
-                pr_debug("Illegal char on line %d\n", __LINE__);
-                return -1;
+    while (1) {
+        while (children__reap(&ctx->children, &id, &status)) {
+            cron_job *job = __vec__at(ctx->tab.jobs, id);
+            struct cron_run *run = __vec__at(ctx->tab.runs, id);
+
+            --run->running;
+            pr_debug("Line %d exited with status %d\n", job->line, status);
+            if (job->dead && !run->running && tab__release(&ctx->tab, id)) {
+                err = -1;
+                goto out;
             }
-        } else {
-            pr_err("Illegal character(%c)\n", **pos);
-            pr_debug("Illegal char on line %d\n", __LINE__);
-            return -1;
         }
-    } else if (**pos == ',') {
-        ses__write_sched(ses, ses->start, ses->start, MIN_STEP);
-        ++*pos;
-        if (parse_ses(pos, ses, min_val, max_val))
-            return -1;
-    } else if (**pos == '/') {
-        int step;
 
-        ++*pos;
-        step = parse_step(pos, ses);
-        if (step == -1)
-            return -1;
-        ses__write_sched(ses, ses->start, -1, step);
-
-        if (**pos == ',') {
-            ++*pos;
-            if (parse_ses(pos, ses, min_val, max_val))
-                return -1;
-        } else if (**pos) {
-            pr_err("Illegal character(%c)\n", **pos);
-            pr_debug("Illegal char on line %d\n", __LINE__);
-            return -1;
+        now = time(NULL);
+        if (ctx->watch_fd != -1 && cron__watch_changed(ctx->watch_fd, ctx->path) &&
+            cron__reload(ctx, now)) {
+            err = -1;
+            goto out;
+        }
+        if (clock__local_changed() && cron__rezone(ctx, now)) {
+            err = -1;
+            goto out;
         }
-    } else {
-        pr_err("Illegal character(%c)\n", **pos);
-        pr_debug("Illegal char on line %d\n", __LINE__);
-        return -1;
-    }
-    return 0;
-}
 
-static int parse_asterisk_lhs(char **pos, Ses *ses, int min_val, int max_val)
-{
-    ++*pos;
-    ses->start = -1;
-    if (**pos == ',') {
-        ses->end = -1;
-        ses__write_sched(ses, ses->start, ses->start, MIN_STEP);
-        ++*pos;
-        if (parse_ses(pos, ses, min_val, max_val))
-            return -1;
-    } else if (**pos == '-') {
-        ++*pos;
-        if (isdigit(**pos)) {
-            char *end = NULL;
-            for(end = *pos; isdigit(*end) && *end; ++end) {}
-            int tmp = atoin(*pos, end - *pos);
-            if (!is_legal(tmp, *pos, end - *pos)) {
-                pr_err("Can't be converted to integer\n");
-                return -1;
-            }
-            if (!check_bound(min_val, max_val, tmp)) {
-                pr_err("Value %d out of range [%d, %d]\n", tmp, min_val, max_val);
-                return -1;
-            }
-            *pos = end;
-            ses->end = tmp;
-
-            if (**pos == '/') {
-                int step;
-
-                ++*pos;
-                step = parse_step(pos, ses);
-                if (step == -1)
-                    return -1;
-                ses__write_sched(ses, ses->start, ses->end, step);
-
-                if (**pos == ',') {
-                    ++*pos;
-                    if (parse_ses(pos, ses, min_val, max_val))
-                        return -1;
-                } else if (**pos) {
-                    pr_err("Illegal character(%c)\n", **pos);
-                    pr_debug("Illegal char on line %d\n", __LINE__);
-                    return -1;
+        /* the engine holds the shared schedules, a due one fires all its jobs */
+        while ((popped = engine->pop(ctx->sched, now, &id)) > 0) {
+            struct share *share = __vec__at(ctx->tab.shares.shares, id);
+            const cron_set *crn_s = __vec__at(ctx->tab.shares.sets, id);
+
+            for (size_t i = 0; i < vec__len_st(share->jobs); i++) {
+                size_t job_id = *(size_t *)__vec__at(share->jobs, i);
+
+                pr_debug("Line %d is due at %s",
+                         ((cron_job *)__vec__at(ctx->tab.jobs, job_id))->line, ctime(&share->next));
+                if (cron__enqueue(ctx, job_id)) {
+                    err = -1;
+                    goto out;
                 }
-            } else if (**pos == ',') {
-                ses__write_sched(ses, ses->start, ses->end, MIN_STEP);
-                ++*pos;
-                if (parse_ses(pos, ses, min_val, max_val))
-                    return -1;
-            } else if (!**pos) {
-                ses__write_sched(ses, ses->start, ses->end, MIN_STEP);
-                return 0;
-            } else {
-                pr_err("Illegal character(%c)\n", **pos);
-                pr_debug("Illegal char on line %d\n", __LINE__);
-                return -1;
             }
-        } else {
-            pr_err("Illegal character(%c)\n", **pos);
-            pr_debug("Illegal char on line %d\n", __LINE__);
-            return -1;
+            share->next = cron_next_fire(crn_s, share->zone, now);
+            if (share->next != -1 &&
+                engine->add(ctx->sched, share->next, id, crn_s, share->zone)) {
+                err = -1;
+                goto out;
+            }
         }
-    } else if (!**pos) {
-        // single asterisk, it's gonna be -1 -1
-        ses->end = -1;
-        ses__write_sched(ses, ses->start, ses->start, MIN_STEP);
-        return 0;
-    } else if (**pos == '/') {
-        int step;
-
-        ++*pos;
-        step = parse_step(pos, ses);
-        if (step == -1)
-            return -1;
-        ses__write_sched(ses, ses->start, ses->start, step);
-
-        if (**pos == ',') {
-            ++*pos;
-            if (parse_ses(pos, ses, min_val, max_val))
-                return -1;
-        } else if (**pos) {
-            pr_err("Illegal character(%c)\n", **pos);
-            pr_debug("Illegal char on line %d\n", __LINE__);
-            return -1;
+        if (popped < 0) {
+            pr_err("The %s engine failed to get to the current time\n", engine->name);
+            err = -1;
+            goto out;
         }
-    } else {
-        pr_err("Illegal character(%c)\n", **pos);
-        pr_debug("Illegal char on line %d\n", __LINE__);
-        return -1;
+        cron__dispatch(ctx);
+
+        due = engine->next(ctx->sched);
+        /* an emptied crontab may get new entries while it's watched */
+        if (due == -1 && !children__running(&ctx->children) && ctx->watch_fd == -1)
+            break;
+        cron__wait_until(due, pfds, ARRAY_SIZE(pfds));
     }
-    return 0;
+    pr_err("None of the jobs will ever fire\n");
+    err = -1;
+out:
+    if (ctx->sched)
+        engine->free(ctx->sched);
+    vec__free(ctx->run_queue);
+    children__free(&ctx->children);
+    return err;
 }
 
-/* caller will clear ses */
-static int parse_ses(char **pos, Ses *ses, int min_val, int max_val)
+/*
+ * The first load maps the cache image of the crontab when it is up to
+ * date, otherwise the crontab is parsed and an image is written for the
+ * next start. Crontabs with bad lines aren't cached, so that their errors
+ * keep being reported.
+ */
+static int cron__load(struct cron_ctx *ctx, const char *data, size_t len, bool use_cache)
 {
-    int err = 0;
-
-    if (pos == NULL || ses == NULL)
-        return -1;
+    char cache_file[PATH_MAX];
+    int threads = ctx->tab.threads;
+    int err;
+
+    if (!use_cache ||
+        snprintf(cache_file, sizeof(cache_file), CACHE_FMT, ctx->path) >= (int)sizeof(cache_file))
+        return tab__load(&ctx->tab, data, len);
+    if (!cache__load(&ctx->tab, cache_file, data, len))
+        return 0;
 
-    /*
-    $root:
-        (num | *)
-        $num:
-            (end | - | , | /)
-            $-:
-                (num | *)
-                $num, $*:
-                    (/ | , | end)
-                    $/:
-                        (step | ,)
-                        $step:
-                            (end)
-                        $,:
-                            (root)
-                    $,:
-                        (root)
-            $,:
-                (root)
-            $/:
-                (step | ,)
-                $step:
-                    (end)
-                $,:
-                    (root)
-        $*:
-            (, | - | end | /)
-            $,:
-                (root)
-            $-:
-                (num)
-                $num:
-                    (/ | , | end)
-                    $/:
-                        (step | ,)
-                        $step:
-                            (end)
-                        $,:
-                            (root)
-                    $,:
-                        (root)
-            $/:
-                (step | ,)
-                $step:
-                    (end)
-                $,:
-                    (root)
-    */
-
-    if (isdigit(**pos)) {
-        err = parse_num_lhs(pos, ses, min_val, max_val);
-        if (err)
-            return err;
-    } else if (**pos == '*') {
-        err = parse_asterisk_lhs(pos, ses, min_val, max_val);
-        if (err)
-            return err;
-    } else {
-        pr_err("Illegal character(%c)\n", **pos);
-        pr_debug("Illegal char on line %d\n", __LINE__);
+    /* start over from an empty table */
+    tab__free(&ctx->tab);
+    if (tab__init(&ctx->tab))
         return -1;
-    }
-    return 0;
+    ctx->tab.threads = threads;
+    err = tab__load(&ctx->tab, data, len);
+    if (!err && !ctx->tab.bad && cache__save(&ctx->tab, cache_file, data, len))
+        pr_err("Failed to write %s\n", cache_file);
+    return err;
 }
 
 /*
- * writes a ranges string only for debug purposes
+ * A time of --simulate: now, @<epoch seconds>, a local YYYY-MM-DD with an
+ * optional HH:MM, or, when base isn't -1, +N followed by m, h or d after base
  */
-static void ses__get_ranges(const Ses *ses, char *ranges, size_t size)
+static int cron__parse_time(const char *str, time_t base, time_t *t)
 {
-    const char *sched = ses->sched;
-    int prev_start = -1;
-
-    for (int i = 0; i < MAX_SCHED; i++) {
-        if (sched[i]) {
-            if (prev_start == -1)
-                prev_start = i;
-        } else if (prev_start != -1) {
-            int written = snprintf(ranges, size, "%d-%d ", prev_start, i - 1);
-            if (written < 0 || (size_t)written >= size)
-                return;
-            ranges += written;
-            size -= written;
-            prev_start = -1;
-        }
+    struct tm info = { .tm_isdst = -1 };
+    long long n;
+    char unit;
+    int end = 0;
+    int more = 0;
+
+    if (!strcmp(str, "now")) {
+        *t = time(NULL);
+        return 0;
     }
-    /* flush a range that extends to the last slot */
-    if (prev_start != -1)
-        snprintf(ranges, size, "%d-%d ", prev_start, MAX_SCHED - 1);
-}
-
-static int parse(const char *vbuf, cron_set *crn_s, char *comm_args, size_t comm_args_len)
-{
-    /* get the raw pointer */
-    char *pos = __vec__at(vbuf, 0);
-    char tok[TOK_LEN];
-    int cnt = 0;
-    size_t vbuf_siz;
-    char ranges[256];
-    static const char *time_types[] = { "minute", "hour", "day_of_month", "month", "day_of_week" };
-
-    memset(tok, 0, sizeof(tok));
-
-    for (int idx = 0;
-         idx < CRON_NUM && get_next_tok(&pos, tok, sizeof(tok));
-         ++idx, ++cnt, memset(tok, 0, sizeof(tok))) {
-        int err;
-        Ses *ses;
-        char *pos = tok;
-
-        memset(ranges, 0, sizeof(ranges));
-
-        switch (idx) {
-        case 0:
-            ses = &crn_s->minute;
-            err = parse_ses(&pos, ses, MIN_MINUTE, MAX_MINUTE);
-            if (err)
-                return err;
-            break;
-        case 1:
-            ses = &crn_s->hour;
-            err = parse_ses(&pos, ses, MIN_HOUR, MAX_HOUR);
-            if (err)
-                return err;
-            break;
-        case 2:
-            ses = &crn_s->day_of_month;
-            err = parse_ses(&pos, ses, MIN_DAY_OF_MONTH, MAX_DAY_OF_MONTH);
-            if (err)
-                return err;
-            break;
-        case 3:
-            ses = &crn_s->month;
-            err = parse_ses(&pos, ses, MIN_MONTH, MAX_MONTH);
-            if (err)
-                return err;
-            break;
-        case 4:
-            ses = &crn_s->day_of_week;
-            err = parse_ses(&pos, ses, MIN_DAY_OF_WEEK, MAX_DAY_OF_WEEK);
-            if (err)
-                return err;
-            break;
-        default:
-            break;
-        }
-        ses__get_ranges(ses, ranges, sizeof(ranges));
-        ses->count = -1; /* dummy starter value */
-        pr_debug("\033[35m" "%-16s ranges: %s\n" "\033[0m", time_types[idx], ranges[0] == 0 ? "All" : ranges);
+    if (sscanf(str, "@%lld%n", &n, &end) == 1 && !str[end]) {
+        *t = n;
+        return 0;
     }
-
-    // TODO: replace with memchr
-    // go to the first non-space
-    vbuf_siz = vec__len(vbuf) * vec__mem_size(vbuf);
-    for (;pos < (char *)__vec__at(vbuf, 0) + vbuf_siz && *pos == ' '; ++pos) {}
-
-    /* copy the rest of the string to comm_args */
-    if (*pos == '\0') {
-        pr_err("Empty command\n");
-        return -1;
+    if (base != -1 && sscanf(str, "+%lld%c%n", &n, &unit, &end) == 2 && !str[end]) {
+        localtime_r(&base, &info);
+        info.tm_isdst = -1;
+        if (unit == 'm')
+            info.tm_min += n;
+        else if (unit == 'h')
+            info.tm_hour += n;
+        else if (unit == 'd')
+            info.tm_mday += n;
+        else
+            return -1;
+        *t = mktime(&info);
+        return 0;
     }
-    strncpy(comm_args, pos, min(vbuf_siz, comm_args_len) - 1);
-
-    if (cnt < CRON_NUM) {
-        pr_err("Only has %d numbers, needs to be %d\n", cnt, CRON_NUM);
+    if (sscanf(str, "%d-%d-%d%n", &info.tm_year, &info.tm_mon, &info.tm_mday, &end) != 3)
         return -1;
-    }
-    return 0;
+    if (str[end] && (sscanf(str + end, "%*1[ T]%d:%d%n", &info.tm_hour, &info.tm_min, &more) != 2 ||
+                     str[end + more]))
+        return -1;
+    info.tm_year -= 1900;
+    info.tm_mon -= 1;
+    *t = mktime(&info);
+    return *t == -1 ? -1 : 0;
 }
 
 static void print_help()
@@ -824,6 +456,13 @@ static void print_help()
         "\n  Cron by Howard Chu\n"
         "\n    -h: Print this message"
         "\n    -f <crontab file>: Path of the crontab file (default: ~/.crontab.txt)"
+        "\n    -e <engine>: Scheduler engine, heap, wheel, index or day (default: heap)"
+        "\n    -l <launcher>: How jobs are started, spawn or fork (default: spawn)"
+        "\n    -j <jobs>: Maximum number of jobs running at once (default: no limit)"
+        "\n    -t <threads>: Threads parsing a large crontab (default: one per CPU)"
+        "\n    -c: Check the crontab, report every bad line and exit"
+        "\n    --simulate <from> <to>: Print every fire time in [from, to) and exit,"
+        "\n        times are now, @<epoch>, YYYY-MM-DD[ HH:MM] or +N<m|h|d> after from"
         "\n\n"
     );
 }
@@ -831,13 +470,25 @@ static void print_help()
 static int start(int argc, char **argv)
 {
     int err = 0;
-    FILE *f;
-    char *vbuf;
-    cron_set crn_s;
-    char comm_args[COMM_LEN];
+    struct file_map map;
     char cron_tab_file[PATH_MAX];
+    struct cron_ctx ctx = {
+        .path = cron_tab_file,
+        .engine = &heap_engine,
+        .launcher = &spawn_launcher,
+        .watch_fd = -1,
+    };
     int opt;
     int offset;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool check = false;
+    bool simulate = false;
+    time_t sim_from = -1;
+    time_t sim_to = -1;
+    static const struct option long_opts[] = {
+        { "simulate", required_argument, NULL, 'S' },
+        { NULL, 0, NULL, 0 },
+    };
 
     memset(cron_tab_file, 0, PATH_MAX);
     char *home = getenv(HOME);
@@ -851,7 +502,10 @@ static int start(int argc, char **argv)
     cron_tab_file[offset] = 0;
 
     // parsing arguments to get the file name
-    while ((opt = getopt(argc, argv, "hf:")) != -1) {
+    /* no permuting, --simulate takes its second argument off argv itself */
+    while ((opt = getopt_long(argc, argv, "+hf:e:l:j:t:c", long_opts, NULL)) != -1) {
+        char *end;
+        long val;
         int len;
 
         switch (opt) {
@@ -860,6 +514,59 @@ static int start(int argc, char **argv)
             strncpy(cron_tab_file, optarg, len);
             cron_tab_file[len] = 0;
             break;
+        case 'e':
+            ctx.engine = engine__find(optarg);
+            if (!ctx.engine) {
+                pr_err("Unknown engine %s\n", optarg);
+                print_help();
+                return -1;
+            }
+            break;
+        case 'l':
+            ctx.launcher = launcher__find(optarg);
+            if (!ctx.launcher) {
+                pr_err("Unknown launcher %s\n", optarg);
+                print_help();
+                return -1;
+            }
+            break;
+        case 'j':
+            /* strtoul() would take a sign and wrap a negative number around */
+            if (!isdigit((unsigned char)*optarg)) {
+                end = optarg;
+            } else {
+                errno = 0;
+                ctx.max_concurrent = strtoul(optarg, &end, 10);
+                if (errno)
+                    end = optarg;
+            }
+            if (end == optarg || *end) {
+                pr_err("-j needs a number of jobs, 0 for no limit, not %s\n", optarg);
+                print_help();
+                return -1;
+            }
+            break;
+        case 't':
+            val = strtol(optarg, &end, 10);
+            if (end == optarg || *end || val < 1 || val > INT_MAX) {
+                pr_err("-t needs a number of threads, not %s\n", optarg);
+                print_help();
+                return -1;
+            }
+            threads = val;
+            break;
+        case 'c':
+            check = true;
+            break;
+        case 'S':
+            if (optind >= argc || cron__parse_time(optarg, -1, &sim_from) ||
+                cron__parse_time(argv[optind++], sim_from, &sim_to)) {
+                pr_err("Bad --simulate range\n");
+                print_help();
+                return -1;
+            }
+            simulate = true;
+            break;
         case 'h':
             print_help();
             return 0;
@@ -872,41 +579,44 @@ static int start(int argc, char **argv)
         }
     }
     pr_debug("Cron tab file location: %s\n", cron_tab_file);
-    f = fopen(cron_tab_file, "r");
-    if (!f) {
+    if (tab__init(&ctx.tab))
+        return -1;
+    ctx.tab.threads = threads;
+    /* watch before reading, so that no change slips in between */
+    if (!check && !simulate)
+        ctx.watch_fd = cron__watch(cron_tab_file);
+
+    if (file__map(cron_tab_file, &map)) {
         perror("Failed to open the crontab file");
         err = -1;
         goto out;
     }
-
-    vbuf = vec__new(sizeof(char));
-    if (!vbuf) {
-        err = -1;
-        goto out_free_fd;
+    /* a crontab that is only looked at doesn't get a cache written next to it */
+    err = cron__load(&ctx, map.data, map.len, !check && !simulate);
+    file__unmap(&map);
+    if (err)
+        goto out;
+    if (check) {
+        printf("%s: %zu jobs, %zu bad lines\n", cron_tab_file, ctx.tab.live, ctx.tab.bad);
+        err = ctx.tab.bad ? -1 : 0;
+        goto out;
     }
-
-    if (read_line_v(f, vbuf)) {
+    if (simulate) {
+        err = sim__run(&ctx.tab, ctx.engine, sim_from, sim_to);
+        goto out;
+    }
+    if (!ctx.tab.live) {
+        pr_err("No jobs found in %s\n", cron_tab_file);
         err = -1;
-        goto out_free;
+        goto out;
     }
-    pr_debug("vector capacity %lu bytes\n", vec__cap(vbuf));
-
-    memset(&crn_s, 0, sizeof(crn_s));
-    memset(comm_args, 0, sizeof(comm_args));
-    err = parse(vbuf, &crn_s, comm_args, sizeof(comm_args));
-    if (err)
-        goto out_free;
 
-    cron__sched(&crn_s, comm_args);
+    err = cron__sched(&ctx);
 
-out_free:
-    vec__free(vbuf);
-out_free_fd:
-    if (fclose(f) == EOF) {
-        perror("Failed to close the crontab file");
-        err = -1;
-    }
 out:
+    if (ctx.watch_fd != -1)
+        close(ctx.watch_fd);
+    tab__free(&ctx.tab);
     return err;
 }
 
@@ -0,0 +1,106 @@
+#ifndef CRON_H
+#define CRON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define CRON_NUM 5
+
+struct clock_zone;
+struct allocator;
+
+#define MIN_MINUTE 0
+#define MAX_MINUTE 59
+#define MIN_HOUR 0
+#define MAX_HOUR 23
+#define MIN_DAY_OF_MONTH 1
+#define MAX_DAY_OF_MONTH 31
+#define MIN_MONTH 1
+#define MAX_MONTH 12
+#define MIN_DAY_OF_WEEK 1
+#define MAX_DAY_OF_WEEK 7
+
+/*
+ * the day matches when either (day of month and month) or day of week
+ * matches, otherwise all three have to match
+ */
+#define CRON_DAY_OR 0x1
+
+/*
+ * What a schedule looks like as a whole, set by parse(). The common shapes
+ * have their own, cheaper ways of matching and of finding the next fire.
+ */
+enum cron_shape {
+    CRON_SHAPE_ANY, /* nothing simpler applies */
+    CRON_SHAPE_EVERY_MINUTE, /* * * * * * */
+    CRON_SHAPE_HOURLY, /* some minutes of every hour of every day, 5 * * * * or 0,30 * * * * */
+    CRON_SHAPE_DAILY, /* some times of every day, 30 2 * * * or 0 9-17 * * * */
+    CRON_SHAPE_NUM,
+};
+
+/*
+ * A parsed schedule, bit n of a field is set when the value n matches. A field
+ * given as * has every bit in its range set, so only the OR case of the
+ * day of month/day of week rule needs a flag.
+ */
+typedef struct cron_set {
+    uint64_t minute;
+    uint32_t hour;
+    uint32_t day_of_month;
+    uint16_t month;
+    uint8_t day_of_week;
+    uint8_t flags;
+    uint8_t shape; /* enum cron_shape */
+} cron_set;
+
+/*
+ * The cold part of a crontab entry in the job table, its schedule is kept
+ * apart (see struct cron_tab) and so is its run state.
+ */
+typedef struct cron_job {
+    /* NULL terminated, the strings follow it in the same allocation */
+    char **argv;
+    /*
+     * environment set by the assignments above the entry, shared with the
+     * entries after the same assignment, NULL to inherit the daemon's
+     */
+    char **envp;
+    uint64_t key; /* hash of the line and the assignments above it */
+    uint32_t share; /* id of the schedule shared with equal jobs, see share.h */
+    uint32_t share_pos; /* index in the jobs of the share */
+    int line; /* line number in the crontab file */
+    uint32_t seen; /* the last load that found the line */
+    int max_running; /* instances allowed to run at once, 0 means no limit */
+    bool dead; /* removed from the crontab, the slot waits to be reused */
+} cron_job;
+
+/* what the daemon tracks of a job while it runs */
+struct cron_run {
+    int running;
+    bool queued; /* waiting in the run queue */
+};
+
+/* a NAME=value line, the pointers point into the line */
+struct cron_assign {
+    const char *name;
+    size_t name_len;
+    const char *value;
+    size_t value_len;
+};
+
+int parse(const char *line, size_t len, cron_set *crn_s, char ***argv,
+          struct allocator *a);
+int parse_assign(const char *line, size_t len, struct cron_assign *assign);
+void parse_set_quiet(bool quiet);
+char **env_set(char **base, const struct cron_assign *assign, struct allocator *a);
+
+typedef int (*cron_match_fn)(const cron_set *crn_s, const struct tm *info);
+
+int cron__should_exec(const cron_set *crn_s, const struct tm *info);
+cron_match_fn cron__matcher(const cron_set *crn_s);
+bool cron__day_match(const cron_set *crn_s, const struct tm *info);
+time_t cron_next_fire(const cron_set *crn_s, struct clock_zone *zone, time_t after);
+
+#endif
@@ -0,0 +1,436 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "engine.h"
+#include "clock.h"
+#include "vec.h"
+
+/*
+ * Expands the schedules a day at a time into one timeline of fire times,
+ * sorted, and pops the jobs by advancing a cursor over it. The day fields
+ * and the OR rule are resolved once per job and day, and a tick costs only
+ * the fires that are due. A day ends at midnight of the process' zone or
+ * when its offset changes, whichever comes first.
+ *
+ * A job fires at an entry of the timeline that is not before the fire time
+ * it was added with, and is idle until it is added again. Jobs added in
+ * the middle of a day are expanded for its rest and merged in. Around DST
+ * changes the expansion follows the rules of cron_next_fire().
+ */
+
+#define ONE_MIN 60
+#define ONE_HOUR (60 * 60)
+#define ONE_DAY (24 * 60 * 60L)
+#define ALL_HOURS ((1U << (MAX_HOUR + 1)) - 1)
+
+struct day_fire {
+    time_t t;
+    size_t id;
+    uint32_t gen; /* of the job when it was expanded */
+};
+
+struct day_job {
+    cron_set crn_s;
+    struct clock_zone *zone;
+    time_t when; /* the fire time the job was added with */
+    uint32_t gen; /* bumped on remove, so that stale entries are skipped */
+    bool known; /* added and not removed */
+    bool armed; /* added and not popped since */
+};
+
+struct day {
+    struct day_job *jobs; /* by id */
+    size_t njobs;
+    size_t armed;
+    struct day_fire *fires; /* vector, the timeline of the day */
+    struct day_fire *spare; /* vector to sort and merge with */
+    size_t pos; /* the first entry that wasn't popped yet */
+    size_t *fresh; /* vector of the ids added since the day was expanded */
+    time_t start; /* of the day */
+    time_t end;
+    time_t done; /* the entries up to here were popped */
+    bool built;
+};
+
+static int day__cmp_fire(const void *a, const void *b)
+{
+    const struct day_fire *x = a, *y = b;
+
+    if (x->t != y->t)
+        return (x->t > y->t) - (x->t < y->t);
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+static int day__push(struct day_fire *fires, time_t t, size_t id, uint32_t gen)
+{
+    struct day_fire fire = { .t = t, .id = id, .gen = gen };
+
+    return __vec__push(fires, &fire, sizeof(fire));
+}
+
+/*
+ * Adds a fire at w - off for every wall clock minute w in [lo, hi) that
+ * crn_s matches. Without fires it only tells whether there is one: it
+ * returns 1 on the first match. -1 on errors.
+ */
+static int day__walls(const cron_set *crn_s, time_t lo, time_t hi, long off, size_t id,
+                      uint32_t gen, struct day_fire *fires)
+{
+    if (lo % ONE_MIN)
+        lo += ONE_MIN - lo % ONE_MIN;
+    for (time_t d = lo / ONE_DAY * ONE_DAY; d < hi; d += ONE_DAY) {
+        struct tm info;
+
+        clock__civil(d, &info);
+        if (!cron__day_match(crn_s, &info))
+            continue;
+        for (uint32_t hours = crn_s->hour; hours; hours &= hours - 1) {
+            time_t base = d + __builtin_ctz(hours) * ONE_HOUR;
+
+            if (base >= hi)
+                break;
+            if (base + ONE_HOUR <= lo)
+                continue;
+            for (uint64_t mins = crn_s->minute; mins; mins &= mins - 1) {
+                time_t w = base + __builtin_ctzll(mins) * ONE_MIN;
+
+                if (w >= hi)
+                    break;
+                if (w < lo)
+                    continue;
+                if (!fires)
+                    return 1;
+                if (day__push(fires, w - off, id, gen))
+                    return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* adds the fires of a job in [a, b), a span of offsets at a time */
+static int day__expand(struct day *day, size_t id, time_t a, time_t b, struct day_fire *fires)
+{
+    struct day_job *job = &day->jobs[id];
+    struct clock_zone *zone = job->zone ? job->zone : clock__local_zone();
+    bool follow = (job->crn_s.hour & ALL_HOURS) == ALL_HOURS;
+    struct clock_range r;
+
+    if (!zone)
+        return -1;
+    for (time_t t = a; t < b; t = r.end < b ? r.end : b) {
+        time_t lo, hi;
+
+        clock__range(zone, t, &r);
+        lo = t + r.off;
+        hi = (r.end < b ? r.end : b) + r.off;
+        if (!follow) {
+            /* the times before the clock went back were read already */
+            if (r.prev_off > r.off && lo < r.start + r.prev_off)
+                lo = r.start + r.prev_off;
+            /* the minutes the clock skipped fire once, at the end of the gap */
+            if (t == r.start && r.prev_off < r.off &&
+                day__walls(&job->crn_s, t + r.prev_off, t + r.off, 0, id, job->gen, NULL) == 1 &&
+                day__push(fires, t, id, job->gen))
+                return -1;
+        }
+        if (day__walls(&job->crn_s, lo, hi, r.off, id, job->gen, fires) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+/* the next midnight of the process' zone after start, or its next offset change */
+static time_t day__end(time_t start)
+{
+    struct clock_zone *zone = clock__local_zone();
+    struct clock_range r;
+    time_t end;
+
+    if (!zone)
+        return start + ONE_DAY;
+    clock__range(zone, start, &r);
+    end = ((start + r.off) / ONE_DAY + 1) * ONE_DAY - r.off;
+    if (r.end > start && r.end < end)
+        end = r.end;
+    return end;
+}
+
+/*
+ * Sorts the fires of the day by minute, counting them per minute of the
+ * day instead of comparing. The ids were expanded in order and stay so
+ * within a minute.
+ */
+static int day__sort(struct day *day)
+{
+    size_t nmin = (day->end - day->start) / ONE_MIN + 1;
+    size_t len = vec__len_st(day->fires);
+    size_t *first = calloc(nmin + 1, sizeof(size_t));
+    struct day_fire *sorted = day->spare;
+
+    if (!first || vec__reserve(sorted, len)) {
+        free(first);
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        struct day_fire *fire = __vec__at(day->fires, i);
+
+        first[(fire->t - day->start) / ONE_MIN + 1]++;
+    }
+    for (size_t m = 1; m <= nmin; m++)
+        first[m] += first[m - 1];
+    vec__resize(sorted, 0);
+    vec__len_inc(sorted, len);
+    for (size_t i = 0; i < len; i++) {
+        struct day_fire *fire = __vec__at(day->fires, i);
+
+        *(struct day_fire *)__vec__at(sorted, first[(fire->t - day->start) / ONE_MIN]++) = *fire;
+    }
+    day->spare = day->fires;
+    day->fires = sorted;
+    free(first);
+    return 0;
+}
+
+/* expands every job for the day that starts at start */
+static int day__build(struct day *day, time_t start)
+{
+    day->start = start;
+    day->end = day__end(start);
+    day->done = start - 1;
+    day->pos = 0;
+    vec__resize(day->fires, 0);
+    vec__resize(day->fresh, 0);
+    for (size_t id = 0; id < day->njobs; id++) {
+        if (day->jobs[id].known && day__expand(day, id, day->start, day->end, day->fires))
+            return -1;
+    }
+    if (day__sort(day))
+        return -1;
+    day->built = true;
+    return 0;
+}
+
+/* expands the jobs added since the day was built for its rest, and merges them in */
+static int day__merge(struct day *day)
+{
+    struct day_fire *added = day->spare;
+    struct day_fire *merged;
+    size_t len = vec__len_st(day->fires);
+    size_t i, j = 0;
+
+    vec__resize(added, 0);
+    for (size_t k = 0; k < vec__len_st(day->fresh); k++) {
+        size_t id = *(size_t *)__vec__at(day->fresh, k);
+        struct day_job *job = &day->jobs[id];
+
+        /* one that is already overdue fires on the next pop */
+        if (job->when <= day->done && day__push(added, job->when, id, job->gen))
+            return -1;
+        if (day__expand(day, id, day->done + 1, day->end, added))
+            return -1;
+    }
+    vec__resize(day->fresh, 0);
+    qsort(__vec__at(added, 0), vec__len_st(added), sizeof(struct day_fire), day__cmp_fire);
+
+    merged = vec__new(sizeof(struct day_fire));
+    if (!merged || vec__reserve(merged, len - day->pos + vec__len_st(added)))
+        goto err;
+    for (i = day->pos; i < len || j < vec__len_st(added);) {
+        struct day_fire *x = i < len ? __vec__at(day->fires, i) : NULL;
+        struct day_fire *y = j < vec__len_st(added) ? __vec__at(added, j) : NULL;
+
+        if (!y || (x && day__cmp_fire(x, y) <= 0)) {
+            __vec__push(merged, x, sizeof(*x));
+            i++;
+        } else {
+            __vec__push(merged, y, sizeof(*y));
+            j++;
+        }
+    }
+    vec__free(day->fires);
+    day->fires = merged;
+    day->pos = 0;
+    return 0;
+err:
+    vec__free(merged);
+    return -1;
+}
+
+static void *day_engine__new(time_t now)
+{
+    struct day *day = calloc(1, sizeof(struct day));
+
+    if (!day)
+        return NULL;
+    day->fires = vec__new(sizeof(struct day_fire));
+    day->spare = vec__new(sizeof(struct day_fire));
+    day->fresh = vec__new(sizeof(size_t));
+    if (!day->fires || !day->spare || !day->fresh) {
+        vec__free(day->fires);
+        vec__free(day->spare);
+        vec__free(day->fresh);
+        free(day);
+        return NULL;
+    }
+    /* the first day is expanded lazily, once the jobs are in */
+    day->start = now;
+    return day;
+}
+
+static void day_engine__free(void *sched)
+{
+    struct day *day = sched;
+
+    if (!day)
+        return;
+    vec__free(day->fires);
+    vec__free(day->spare);
+    vec__free(day->fresh);
+    free(day->jobs);
+    free(day);
+}
+
+static int day_engine__add(void *sched, time_t when, size_t id, const cron_set *crn_s,
+                           struct clock_zone *zone)
+{
+    struct day *day = sched;
+    struct day_job *job;
+
+    if (id >= day->njobs) {
+        size_t n = day->njobs ? day->njobs : 16;
+        struct day_job *jobs;
+
+        while (n <= id)
+            n *= 2;
+        jobs = realloc(day->jobs, n * sizeof(*jobs));
+        if (!jobs)
+            return -1;
+        for (size_t i = day->njobs; i < n; i++)
+            jobs[i] = (struct day_job){ 0 };
+        day->jobs = jobs;
+        day->njobs = n;
+    }
+    job = &day->jobs[id];
+    if (!job->known) {
+        job->crn_s = *crn_s;
+        job->zone = zone;
+        job->known = true;
+        if (day->built && __vec__push(day->fresh, &id, sizeof(id)))
+            return -1;
+    }
+    if (!job->armed) {
+        job->armed = true;
+        ++day->armed;
+    }
+    job->when = when;
+    return 0;
+}
+
+static void day_engine__remove(void *sched, size_t id)
+{
+    struct day *day = sched;
+    struct day_job *job;
+
+    if (id >= day->njobs || !day->jobs[id].known)
+        return;
+    job = &day->jobs[id];
+    if (job->armed)
+        --day->armed;
+    job->armed = false;
+    job->known = false;
+    ++job->gen;
+}
+
+/* expands the first day or merges the jobs added since */
+static int day__refresh(struct day *day)
+{
+    if (!day->built)
+        return day__build(day, day->start);
+    if (!vec__is_empty(day->fresh))
+        return day__merge(day);
+    return 0;
+}
+
+static bool day__stale(const struct day *day, const struct day_fire *fire)
+{
+    const struct day_job *job = &day->jobs[fire->id];
+
+    return !job->known || job->gen != fire->gen;
+}
+
+/* the next entry of the timeline, or the end of the day if it has none left */
+static time_t day_engine__next(void *sched)
+{
+    struct day *day = sched;
+
+    if (!day->armed || day__refresh(day))
+        return -1;
+    while (day->pos < vec__len_st(day->fires)) {
+        struct day_fire *fire = __vec__at(day->fires, day->pos);
+
+        if (!day__stale(day, fire))
+            return fire->t;
+        day->pos++;
+    }
+    return day->end;
+}
+
+/*
+ * Where the day after the current one starts. The days before the earliest
+ * pending fire time are skipped, a clock that jumped far ahead doesn't
+ * expand all of them.
+ */
+static time_t day__skip(const struct day *day, time_t now)
+{
+    time_t start = now;
+
+    for (size_t id = 0; id < day->njobs; id++) {
+        if (day->jobs[id].armed && day->jobs[id].when < start)
+            start = day->jobs[id].when;
+    }
+    return start > day->end ? start : day->end;
+}
+
+static int day_engine__pop(void *sched, time_t now, size_t *id)
+{
+    struct day *day = sched;
+
+    if (day__refresh(day))
+        return -1;
+    while (1) {
+        while (day->pos < vec__len_st(day->fires)) {
+            struct day_fire *fire = __vec__at(day->fires, day->pos);
+            struct day_job *job = &day->jobs[fire->id];
+
+            if (fire->t > now)
+                goto out;
+            day->pos++;
+            if (day__stale(day, fire) || !job->armed || fire->t < job->when)
+                continue;
+            job->armed = false;
+            --day->armed;
+            *id = fire->id;
+            return 1;
+        }
+        /* the day is over, on to the next one with anything due */
+        if (now < day->end)
+            break;
+        if (day__build(day, day__skip(day, now)))
+            return -1;
+    }
+out:
+    if (now > day->done)
+        day->done = now < day->end ? now : day->end - 1;
+    return 0;
+}
+
+const struct engine day_engine = {
+    .name = "day",
+    .new = day_engine__new,
+    .free = day_engine__free,
+    .add = day_engine__add,
+    .remove = day_engine__remove,
+    .next = day_engine__next,
+    .pop = day_engine__pop,
+};
@@ -1 +1 @@
-gcc -DDEBUG atoin.c vec.c file.c cron.c && ./a.out -f crontab.txt
+gcc -pthread -DDEBUG atoin.c vec.c file.c parse.c sched.c clock.c hash.c tab.c cache.c heap.c wheel.c index.c day.c engine.c share.c child.c launch.c sim.c cron.c && ./a.out -f crontab.txt --simulate now +1d
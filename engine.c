@@ -0,0 +1,21 @@
+#include <string.h>
+
+#include "util.h"
+#include "engine.h"
+
+static const struct engine *engines[] = {
+    &heap_engine,
+    &wheel_engine,
+    &index_engine,
+    &day_engine,
+};
+
+/* NULL if there is no engine with that name */
+const struct engine *engine__find(const char *name)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(engines); i++) {
+        if (!strcmp(engines[i]->name, name))
+            return engines[i];
+    }
+    return NULL;
+}
@@ -0,0 +1,38 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "cron.h"
+
+/*
+ * A scheduler engine keeps one pending fire time per job id. An id is only
+ * added again after it was popped.
+ */
+struct engine {
+    const char *name;
+    void *(*new)(time_t now);
+    void (*free)(void *sched);
+    /* crn_s and zone are the job's schedule, for engines that match it themselves */
+    int (*add)(void *sched, time_t when, size_t id, const cron_set *crn_s,
+               struct clock_zone *zone);
+    /* drops the pending fire time of id, if there is one */
+    void (*remove)(void *sched, size_t id);
+    /* lower bound of the earliest pending fire time, -1 if nothing is pending */
+    time_t (*next)(void *sched);
+    /*
+     * takes one job due at or before now, returns 0 when there is none and
+     * -1 when the engine failed to get to now
+     */
+    int (*pop)(void *sched, time_t now, size_t *id);
+};
+
+extern const struct engine heap_engine;
+extern const struct engine wheel_engine;
+extern const struct engine index_engine;
+extern const struct engine day_engine;
+
+const struct engine *engine__find(const char *name);
+
+#endif
@@ -1,52 +1,161 @@
+#include <fcntl.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include "util.h"
 #include "file.h"
-#include "vec.h"
 
-#define STEP 256
+/*
+ * Maps the whole file instead of reading it, lines are then handed out as
+ * views into the mapping without being copied. Returns -1 with errno set.
+ */
+int file__map(const char *path, struct file_map *map)
+{
+    int flags = MAP_PRIVATE;
+    struct stat st;
+    void *data;
+    int fd;
+
+    map->data = NULL;
+    map->len = 0;
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &st))
+        goto err;
+    /* mmap() refuses an empty mapping */
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+#ifdef MAP_POPULATE
+    /* the file is read front to back right away, fault it in at once */
+    flags |= MAP_POPULATE;
+#endif
+    data = mmap(NULL, st.st_size, PROT_READ, flags, fd, 0);
+    if (data == MAP_FAILED)
+        goto err;
+    close(fd);
+    map->data = data;
+    map->len = st.st_size;
+    return 0;
+err:
+    close(fd);
+    return -1;
+}
 
-/* vbuf is a vector */
-int read_line_v(FILE *f, char *vbuf)
+void file__unmap(struct file_map *map)
 {
-    int err = 0;
-    size_t idx = 0;
-    size_t bytes;
+    if (map->data)
+        munmap((void *)map->data, map->len);
+    map->data = NULL;
+    map->len = 0;
+}
 
-    vec__reserve(vbuf, STEP);
+#define BLOCK 64
 
-    while ((bytes = fread(__vec__at(vbuf, idx), vec__mem_size(vbuf), min(vec__cap(vbuf) - idx, STEP), f))) {
-        size_t pre_idx = idx;
-        char *vbuf_raw = NULL;
+/* bit i is set when block[i] is a newline, block is BLOCK bytes long */
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static uint64_t nl_mask_avx2(const char *block)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    __m256i lo = _mm256_loadu_si256((const __m256i *)block);
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(block + 32));
 
-        idx += bytes;
-        vec__len_inc(vbuf, bytes / vec__mem_size(vbuf));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl)) |
+           (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl)) << 32;
+}
 
-        /* check if there's a newline */
-        vbuf_raw = __vec__at(vbuf, 0);
-        for (size_t i = pre_idx; i < idx; i++) {
-            if (vbuf_raw[i] == '\n') {
-                size_t new_size = i / vec__mem_size(vbuf);
+__attribute__((target("sse2")))
+static uint64_t nl_mask_sse2(const char *block)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    uint64_t mask = 0;
 
-                vec__resize(vbuf, new_size);
-                goto read_out;
-            }
-        }
+    for (int i = 0; i < BLOCK / 16; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(block + i * 16));
 
-        if (vec__cap(vbuf) == idx) {
-            if (vec__alloc(vbuf, STEP))
-                return -1;
-        }
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (i * 16);
     }
+    return mask;
+}
 
-read_out:
-    // insert null term
-    if (vec__cap(vbuf) >= vec__len(vbuf) + 1)
-        ((char *)__vec__at(vbuf, 0))[vec__len(vbuf)] = 0;
-    else
-        *((char *)__vec__at(vbuf, vec__cap(vbuf) - 1)) = '\0';
+static uint64_t (*nl_mask)(const char *block) = nl_mask_sse2;
 
-    pr_debug("Read line: \" %s \"\n", (char *)__vec__at(vbuf, 0));
-    return 0;
+/* picks the widest variant the CPU has before any thread can scan */
+__attribute__((constructor))
+static void nl_mask_init(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        nl_mask = nl_mask_avx2;
+}
+#else
+static uint64_t nl_mask(const char *block)
+{
+    uint64_t mask = 0;
+
+    for (int i = 0; i < BLOCK; i++)
+        mask |= (uint64_t)(block[i] == '\n') << i;
+    return mask;
+}
+#endif
+
+/* the newlines of the block at off, which may be cut short by the end */
+static uint64_t file__block_mask(const struct file_lines *it, size_t off)
+{
+    uint64_t mask = 0;
+
+    if (it->len - off >= BLOCK)
+        return nl_mask(it->data + off);
+    for (size_t i = off; i < it->len; i++)
+        mask |= (uint64_t)(it->data[i] == '\n') << (i - off);
+    return mask;
+}
+
+void file__lines_init(struct file_lines *it, const char *data, size_t len)
+{
+    it->data = data;
+    it->len = len;
+    it->pos = 0;
+    it->block = 0;
+    it->mask = len ? file__block_mask(it, 0) : 0;
 }
 
+/*
+ * Takes the next line, without its newline. Returns 1 when there are no
+ * more lines. Short lines share a block, so finding their end is a bit
+ * scan rather than a call into memchr().
+ */
+int file__next_line(struct file_lines *it, const char **line, size_t *len)
+{
+    size_t nl;
+
+    if (it->pos == it->len)
+        return 1;
+    while (!it->mask) {
+        it->block += BLOCK;
+        if (it->block >= it->len) {
+            /* the last line has no newline */
+            nl = it->len;
+            goto out;
+        }
+        it->mask = file__block_mask(it, it->block);
+    }
+    nl = it->block + __builtin_ctzll(it->mask);
+    it->mask &= it->mask - 1;
+out:
+    *line = it->data + it->pos;
+    *len = nl - it->pos;
+    it->pos = min(nl + 1, it->len);
+
+    pr_debug("Read line: \" %.*s \"\n", (int)*len, *line);
+    return 0;
+}
@@ -1,3 +1,27 @@
-#include <stdio.h>
+#ifndef FILE_H
+#define FILE_H
 
-int read_line_v(FILE *f, char *vbuf);
+#include <stddef.h>
+#include <stdint.h>
+
+/* a file mapped read-only into memory */
+struct file_map {
+    const char *data; /* NULL when the file is empty */
+    size_t len;
+};
+
+/* walks the lines of a buffer, newlines are found 64 bytes at a time */
+struct file_lines {
+    const char *data;
+    size_t len;
+    size_t pos; /* start of the next line */
+    size_t block; /* offset of the 64 byte block mask covers */
+    uint64_t mask; /* newlines of the block at or after pos */
+};
+
+int file__map(const char *path, struct file_map *map);
+void file__unmap(struct file_map *map);
+void file__lines_init(struct file_lines *it, const char *data, size_t len);
+int file__next_line(struct file_lines *it, const char **line, size_t *len);
+
+#endif
@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+
+#define HMAP_INIT_CAP 64
+#define EMPTY SIZE_MAX
+#define DELETED (SIZE_MAX - 1)
+
+/* FNV-1a, seeded so that hashes can be chained */
+uint64_t hash__bytes(const void *data, size_t len, uint64_t seed)
+{
+    const unsigned char *p = data;
+    uint64_t h = seed;
+
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* chains hash onto seed, the order matters */
+uint64_t hash__mix(uint64_t seed, uint64_t hash)
+{
+    return hash__bytes(&hash, sizeof(hash), seed);
+}
+
+/*
+ * For bulk data, takes 8 bytes per step where hash__bytes() takes one. Not
+ * interchangeable with hash__bytes().
+ */
+uint64_t hash__data(const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    uint64_t h = HASH_SEED ^ len;
+    uint64_t w;
+
+    for (; len >= sizeof(w); p += sizeof(w), len -= sizeof(w)) {
+        memcpy(&w, p, sizeof(w));
+        h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 32;
+    }
+    w = 0;
+    memcpy(&w, p, len);
+    h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+    return h ^ h >> 29;
+}
+
+static struct hmap_slot *hmap__alloc(size_t cap)
+{
+    struct hmap_slot *slots = malloc(cap * sizeof(*slots));
+
+    if (!slots)
+        return NULL;
+    for (size_t i = 0; i < cap; i++)
+        slots[i].val = EMPTY;
+    return slots;
+}
+
+int hmap__init(struct hmap *map)
+{
+    map->slots = hmap__alloc(HMAP_INIT_CAP);
+    if (!map->slots)
+        return -1;
+    map->cap = HMAP_INIT_CAP;
+    map->len = 0;
+    map->used = 0;
+    return 0;
+}
+
+void hmap__free(struct hmap *map)
+{
+    free(map->slots);
+    map->slots = NULL;
+    map->cap = 0;
+    map->len = 0;
+    map->used = 0;
+}
+
+static void hmap__insert(struct hmap_slot *slots, size_t cap, uint64_t key, size_t val)
+{
+    size_t i = key & (cap - 1);
+
+    while (slots[i].val != EMPTY && slots[i].val != DELETED)
+        i = (i + 1) & (cap - 1);
+    slots[i].key = key;
+    slots[i].val = val;
+}
+
+/* rehashing also drops the deleted slots */
+static int hmap__rehash(struct hmap *map, size_t cap)
+{
+    struct hmap_slot *slots = hmap__alloc(cap);
+
+    if (!slots)
+        return -1;
+    for (size_t i = 0; i < map->cap; i++) {
+        if (map->slots[i].val == EMPTY || map->slots[i].val == DELETED)
+            continue;
+        hmap__insert(slots, cap, map->slots[i].key, map->slots[i].val);
+    }
+    map->used = map->len;
+    free(map->slots);
+    map->slots = slots;
+    map->cap = cap;
+    return 0;
+}
+
+/* the same key may be added more than once */
+int hmap__add(struct hmap *map, uint64_t key, size_t val)
+{
+    /* keep the load factor under 1/2, only grow if it isn't deleted slots */
+    if ((map->used + 1) * 2 > map->cap &&
+        hmap__rehash(map, (map->len + 1) * 4 > map->cap ? map->cap * 2 : map->cap))
+        return -1;
+    hmap__insert(map->slots, map->cap, key, val);
+    ++map->len;
+    ++map->used;
+    return 0;
+}
+
+void hmap__del(struct hmap *map, uint64_t key, size_t val)
+{
+    size_t i = key & (map->cap - 1);
+
+    while (map->slots[i].val != EMPTY) {
+        if (map->slots[i].key == key && map->slots[i].val == val) {
+            map->slots[i].val = DELETED;
+            --map->len;
+            return;
+        }
+        i = (i + 1) & (map->cap - 1);
+    }
+}
+
+/*
+ * Iterates over the values stored under key, *iter starts at 0. Returns
+ * SIZE_MAX when there are no more.
+ */
+size_t hmap__next(const struct hmap *map, uint64_t key, size_t *iter)
+{
+    size_t i = (key + *iter) & (map->cap - 1);
+
+    while (map->slots[i].val != EMPTY) {
+        ++*iter;
+        if (map->slots[i].key == key && map->slots[i].val != DELETED)
+            return map->slots[i].val;
+        i = (key + *iter) & (map->cap - 1);
+    }
+    return SIZE_MAX;
+}
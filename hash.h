@@ -0,0 +1,32 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HASH_SEED 0xcbf29ce484222325ULL
+
+uint64_t hash__bytes(const void *data, size_t len, uint64_t seed);
+uint64_t hash__mix(uint64_t seed, uint64_t hash);
+uint64_t hash__data(const void *data, size_t len);
+
+/* an open addressing multimap from 64-bit keys to ids */
+struct hmap_slot {
+    uint64_t key;
+    size_t val;
+};
+
+struct hmap {
+    struct hmap_slot *slots;
+    size_t cap; /* a power of two */
+    size_t len; /* live slots */
+    size_t used; /* live and deleted slots */
+};
+
+int hmap__init(struct hmap *map);
+void hmap__free(struct hmap *map);
+int hmap__add(struct hmap *map, uint64_t key, size_t val);
+void hmap__del(struct hmap *map, uint64_t key, size_t val);
+size_t hmap__next(const struct hmap *map, uint64_t key, size_t *iter);
+
+#endif
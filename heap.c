@@ -0,0 +1,206 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "heap.h"
+#include "engine.h"
+#include "vec.h"
+
+/* 4 children share a cache line, so sifting down touches fewer lines */
+#define ARITY 4
+#define NPOS SIZE_MAX
+
+static struct heap_node *heap__at(struct heap *heap, size_t pos)
+{
+    return __vec__at(heap->nodes, pos);
+}
+
+static size_t *heap__pos(struct heap *heap, size_t id)
+{
+    return __vec__at(heap->pos, id);
+}
+
+static void heap__set(struct heap *heap, size_t pos, const struct heap_node *node)
+{
+    *heap__at(heap, pos) = *node;
+    *heap__pos(heap, node->id) = pos;
+}
+
+static void heap__sift_up(struct heap *heap, size_t pos)
+{
+    struct heap_node node = *heap__at(heap, pos);
+
+    while (pos > 0) {
+        size_t parent = (pos - 1) / ARITY;
+
+        if (heap__at(heap, parent)->when <= node.when)
+            break;
+        heap__set(heap, pos, heap__at(heap, parent));
+        pos = parent;
+    }
+    heap__set(heap, pos, &node);
+}
+
+static void heap__sift_down(struct heap *heap, size_t pos)
+{
+    size_t len = vec__len_st(heap->nodes);
+    struct heap_node node = *heap__at(heap, pos);
+
+    while (true) {
+        size_t first = pos * ARITY + 1;
+        size_t smallest = pos;
+        time_t when = node.when;
+
+        for (size_t child = first; child < first + ARITY && child < len; child++) {
+            if (heap__at(heap, child)->when < when) {
+                smallest = child;
+                when = heap__at(heap, child)->when;
+            }
+        }
+        if (smallest == pos)
+            break;
+        heap__set(heap, pos, heap__at(heap, smallest));
+        pos = smallest;
+    }
+    heap__set(heap, pos, &node);
+}
+
+int heap__init(struct heap *heap)
+{
+    heap->nodes = vec__new(sizeof(struct heap_node));
+    heap->pos = vec__new(sizeof(size_t));
+    if (!heap->nodes || !heap->pos) {
+        heap__free(heap);
+        return -1;
+    }
+    return 0;
+}
+
+void heap__free(struct heap *heap)
+{
+    vec__free(heap->nodes);
+    vec__free(heap->pos);
+    heap->nodes = NULL;
+    heap->pos = NULL;
+}
+
+/* id must not have a timer yet */
+int heap__push(struct heap *heap, time_t when, size_t id)
+{
+    struct heap_node node = { .when = when, .id = id };
+    size_t npos = NPOS;
+
+    while (vec__len_st(heap->pos) <= id) {
+        if (__vec__push(heap->pos, &npos, sizeof(npos)))
+            return -1;
+    }
+    if (__vec__push(heap->nodes, &node, sizeof(node)))
+        return -1;
+    heap__sift_up(heap, vec__len_st(heap->nodes) - 1);
+    return 0;
+}
+
+/* the earliest timer, NULL if the heap is empty */
+struct heap_node *heap__top(struct heap *heap)
+{
+    if (vec__is_empty(heap->nodes))
+        return NULL;
+    return heap__at(heap, 0);
+}
+
+/* drops the timer at pos, the last one takes its place */
+static void heap__delete(struct heap *heap, size_t pos)
+{
+    size_t last = vec__len_st(heap->nodes) - 1;
+    struct heap_node moved = *heap__at(heap, last);
+
+    *heap__pos(heap, heap__at(heap, pos)->id) = NPOS;
+    vec__pop(heap->nodes);
+    if (pos == last)
+        return;
+    heap__set(heap, pos, &moved);
+    /* the moved timer may belong above or below */
+    heap__sift_up(heap, pos);
+    heap__sift_down(heap, *heap__pos(heap, moved.id));
+}
+
+void heap__pop(struct heap *heap)
+{
+    if (!vec__is_empty(heap->nodes))
+        heap__delete(heap, 0);
+}
+
+/* nothing happens if id has no timer */
+void heap__remove(struct heap *heap, size_t id)
+{
+    size_t pos;
+
+    if (id >= vec__len_st(heap->pos))
+        return;
+    pos = *heap__pos(heap, id);
+    if (pos != NPOS)
+        heap__delete(heap, pos);
+}
+
+static void *heap_engine__new(time_t now)
+{
+    struct heap *heap = malloc(sizeof(struct heap));
+
+    (void)now;
+    if (!heap)
+        return NULL;
+    if (heap__init(heap)) {
+        free(heap);
+        return NULL;
+    }
+    return heap;
+}
+
+static void heap_engine__free(void *sched)
+{
+    if (!sched)
+        return;
+    heap__free(sched);
+    free(sched);
+}
+
+static int heap_engine__add(void *sched, time_t when, size_t id, const cron_set *crn_s,
+                           struct clock_zone *zone)
+{
+    (void)crn_s;
+    (void)zone;
+    return heap__push(sched, when, id);
+}
+
+static void heap_engine__remove(void *sched, size_t id)
+{
+    heap__remove(sched, id);
+}
+
+static time_t heap_engine__next(void *sched)
+{
+    struct heap_node *top = heap__top(sched);
+
+    return top ? top->when : -1;
+}
+
+static int heap_engine__pop(void *sched, time_t now, size_t *id)
+{
+    struct heap_node *top = heap__top(sched);
+
+    if (!top || top->when > now)
+        return 0;
+    *id = top->id;
+    heap__pop(sched);
+    return 1;
+}
+
+const struct engine heap_engine = {
+    .name = "heap",
+    .new = heap_engine__new,
+    .free = heap_engine__free,
+    .add = heap_engine__add,
+    .remove = heap_engine__remove,
+    .next = heap_engine__next,
+    .pop = heap_engine__pop,
+};
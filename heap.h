@@ -0,0 +1,26 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stddef.h>
+#include <time.h>
+
+/* a timer, id is the index of the job in the job table */
+struct heap_node {
+    time_t when;
+    size_t id;
+};
+
+/* a 4-ary min-heap ordered by when, with at most one timer per id */
+struct heap {
+    struct heap_node *nodes; /* vector */
+    size_t *pos; /* vector indexed by id, where the id's timer is in nodes */
+};
+
+int heap__init(struct heap *heap);
+void heap__free(struct heap *heap);
+int heap__push(struct heap *heap, time_t when, size_t id);
+struct heap_node *heap__top(struct heap *heap);
+void heap__pop(struct heap *heap);
+void heap__remove(struct heap *heap, size_t id);
+
+#endif
@@ -0,0 +1,400 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "clock.h"
+#include "vec.h"
+
+/*
+ * An inverted index of the schedules: one bitmap of job ids per value of
+ * each field, so that the jobs due in a minute are the AND of the bitmaps
+ * of its minute, its hour and its day, 64 jobs per word instead of one
+ * schedule test per job. The day bitmap is built once per day and zone
+ * from the day of month, month and day of week bitmaps.
+ *
+ * The engine evaluates every minute up to the time it is asked about, a
+ * job fires at a minute its fields match and that is not before the fire
+ * time it was added with. A popped job is idle until it is added again.
+ * Around DST changes it follows the rules of cron_next_fire().
+ */
+
+#define ONE_MIN 60
+#define ONE_DAY (24 * 60 * 60L)
+#define ALL_HOURS ((1U << (MAX_HOUR + 1)) - 1)
+
+enum {
+    ROW_MINUTE = 0,
+    ROW_HOUR = ROW_MINUTE + MAX_MINUTE + 1,
+    ROW_DOM = ROW_HOUR + MAX_HOUR + 1, /* indexed by the value, row 0 is unused */
+    ROW_MONTH = ROW_DOM + MAX_DAY_OF_MONTH + 1,
+    ROW_DOW = ROW_MONTH + MAX_MONTH + 1,
+    ROW_OR = ROW_DOW + MAX_DAY_OF_WEEK + 1, /* CRON_DAY_OR */
+    ROW_FOLLOW = ROW_OR + 1, /* every hour set, follows the clock */
+    ROW_ARMED = ROW_FOLLOW + 1, /* added and not popped since */
+    ROW_INDEXED = ROW_ARMED + 1,
+    ROW_NUM,
+};
+
+/* which jobs a minute of a zone is evaluated for */
+enum {
+    MATCH_ALL,
+    MATCH_FOLLOW, /* the repeated hour at the end of DST */
+    MATCH_ONCE, /* the minutes skipped at the start of DST */
+};
+
+/* the jobs of one zone and the ones whose day fields match its current day */
+struct index_zone {
+    struct clock_zone *zone; /* NULL for the process' zone */
+    uint64_t *jobs;
+    uint64_t *day;
+    time_t day_num; /* the wall clock day day is for, -1 if none yet */
+};
+
+struct index {
+    size_t nwords; /* of every bitmap */
+    uint64_t *rows[ROW_NUM];
+    struct index_zone *zones; /* vector */
+    time_t *when; /* by id, the fire time a job was added with */
+    size_t minute_cnt[MAX_MINUTE + 1]; /* indexed jobs per minute */
+    size_t armed;
+    time_t cur; /* the first minute that wasn't evaluated yet */
+    size_t *due; /* vector of the ids that fired in the last evaluated minute */
+    size_t due_pos; /* the next one pop() hands out */
+};
+
+static void bit_set(uint64_t *row, size_t id)
+{
+    row[id / 64] |= 1ULL << id % 64;
+}
+
+static void bit_clear(uint64_t *row, size_t id)
+{
+    row[id / 64] &= ~(1ULL << id % 64);
+}
+
+static bool bit_test(const uint64_t *row, size_t id)
+{
+    return row[id / 64] >> id % 64 & 1;
+}
+
+static int grow_row(uint64_t **row, size_t old, size_t words)
+{
+    uint64_t *grown = realloc(*row, words * sizeof(uint64_t));
+
+    if (!grown)
+        return -1;
+    memset(grown + old, 0, (words - old) * sizeof(uint64_t));
+    *row = grown;
+    return 0;
+}
+
+/* makes room for the id in every bitmap */
+static int index__grow(struct index *idx, size_t id)
+{
+    size_t words = idx->nwords ? idx->nwords : 1;
+    time_t *when;
+
+    if (id < idx->nwords * 64)
+        return 0;
+    while (words * 64 <= id)
+        words *= 2;
+    for (int i = 0; i < ROW_NUM; i++) {
+        if (grow_row(&idx->rows[i], idx->nwords, words))
+            return -1;
+    }
+    for (size_t i = 0; i < vec__len_st(idx->zones); i++) {
+        struct index_zone *z = __vec__at(idx->zones, i);
+
+        if (grow_row(&z->jobs, idx->nwords, words) || grow_row(&z->day, idx->nwords, words))
+            return -1;
+        z->day_num = -1;
+    }
+    when = realloc(idx->when, words * 64 * sizeof(time_t));
+    if (!when)
+        return -1;
+    idx->when = when;
+    idx->nwords = words;
+    return 0;
+}
+
+static struct index_zone *index__zone(struct index *idx, struct clock_zone *zone)
+{
+    struct index_zone z = { .zone = zone, .day_num = -1 };
+
+    for (size_t i = 0; i < vec__len_st(idx->zones); i++) {
+        struct index_zone *found = __vec__at(idx->zones, i);
+
+        if (found->zone == zone)
+            return found;
+    }
+    z.jobs = calloc(idx->nwords, sizeof(uint64_t));
+    z.day = calloc(idx->nwords, sizeof(uint64_t));
+    if (!z.jobs || !z.day || __vec__push(idx->zones, &z, sizeof(z))) {
+        free(z.jobs);
+        free(z.day);
+        return NULL;
+    }
+    return __vec__at(idx->zones, vec__len_st(idx->zones) - 1);
+}
+
+/* the bitmaps of the jobs whose day fields match the wall clock day */
+static void index__day(struct index *idx, struct index_zone *z, time_t day_num)
+{
+    uint64_t **rows = idx->rows;
+    struct tm info;
+
+    if (z->day_num == day_num)
+        return;
+    clock__civil(day_num * ONE_DAY, &info);
+    for (size_t w = 0; w < idx->nwords; w++) {
+        uint64_t mday = rows[ROW_DOM + info.tm_mday][w] & rows[ROW_MONTH + info.tm_mon + 1][w];
+        uint64_t wday = rows[ROW_DOW + info.tm_wday + 1][w];
+        uint64_t or = rows[ROW_OR][w];
+
+        z->day[w] = (mday & wday & ~or) | ((mday | wday) & or);
+    }
+    z->day_num = day_num;
+}
+
+/* queues the armed jobs of z that the wall clock time matches at t */
+static int index__match(struct index *idx, struct index_zone *z, time_t wall, time_t t, int mode)
+{
+    uint64_t **rows = idx->rows;
+    struct tm info;
+
+    clock__civil(wall, &info);
+    index__day(idx, z, wall / ONE_DAY);
+    for (size_t w = 0; w < idx->nwords; w++) {
+        uint64_t bits = rows[ROW_MINUTE + info.tm_min][w] & rows[ROW_HOUR + info.tm_hour][w] &
+                        z->day[w] & z->jobs[w] & rows[ROW_ARMED][w];
+
+        if (mode == MATCH_FOLLOW)
+            bits &= rows[ROW_FOLLOW][w];
+        else if (mode == MATCH_ONCE)
+            bits &= ~rows[ROW_FOLLOW][w];
+        while (bits) {
+            size_t id = w * 64 + __builtin_ctzll(bits);
+
+            bits &= bits - 1;
+            if (idx->when[id] > t)
+                continue;
+            if (__vec__push(idx->due, &id, sizeof(id)))
+                return -1;
+            bit_clear(rows[ROW_ARMED], id);
+            --idx->armed;
+        }
+    }
+    return 0;
+}
+
+/* the jobs due in the minute t, in every zone */
+static int index__tick(struct index *idx, time_t t)
+{
+    for (size_t i = 0; i < vec__len_st(idx->zones); i++) {
+        struct index_zone *z = __vec__at(idx->zones, i);
+        struct clock_zone *zone = z->zone ? z->zone : clock__local_zone();
+        struct clock_range r;
+        time_t wall;
+        int mode = MATCH_ALL;
+
+        if (!zone)
+            return -1;
+        clock__range(zone, t, &r);
+        wall = t + r.off;
+        /* the minutes the clock skipped fire once, at the end of the gap */
+        if (t == r.start && r.prev_off < r.off) {
+            for (time_t g = r.start + r.prev_off; g < wall; g += ONE_MIN) {
+                if (index__match(idx, z, g, t, MATCH_ONCE))
+                    return -1;
+            }
+        }
+        /* the times before the clock went back were read already */
+        if (r.prev_off > r.off && wall < r.start + r.prev_off)
+            mode = MATCH_FOLLOW;
+        if (index__match(idx, z, wall, t, mode))
+            return -1;
+    }
+    return 0;
+}
+
+static void *index_engine__new(time_t now)
+{
+    struct index *idx = calloc(1, sizeof(struct index));
+
+    if (!idx)
+        return NULL;
+    idx->zones = vec__new(sizeof(struct index_zone));
+    idx->due = vec__new(sizeof(size_t));
+    if (!idx->zones || !idx->due) {
+        vec__free(idx->zones);
+        vec__free(idx->due);
+        free(idx);
+        return NULL;
+    }
+    idx->cur = now - now % ONE_MIN;
+    return idx;
+}
+
+static void index_engine__free(void *sched)
+{
+    struct index *idx = sched;
+
+    if (!idx)
+        return;
+    for (int i = 0; i < ROW_NUM; i++)
+        free(idx->rows[i]);
+    for (size_t i = 0; i < vec__len_st(idx->zones); i++) {
+        struct index_zone *z = __vec__at(idx->zones, i);
+
+        free(z->jobs);
+        free(z->day);
+    }
+    vec__free(idx->zones);
+    vec__free(idx->due);
+    free(idx->when);
+    free(idx);
+}
+
+/* sets the bits of every value of the field, from bit lo of mask on */
+static void index__field(struct index *idx, int row, uint64_t mask, int lo, int hi, size_t id)
+{
+    for (int v = lo; v <= hi; v++) {
+        if (mask >> v & 1)
+            bit_set(idx->rows[row + v], id);
+    }
+}
+
+/* a job is indexed on its first add and only armed again after a pop */
+static int index_engine__add(void *sched, time_t when, size_t id, const cron_set *crn_s,
+                             struct clock_zone *zone)
+{
+    struct index *idx = sched;
+    struct index_zone *z;
+
+    if (index__grow(idx, id))
+        return -1;
+    if (!bit_test(idx->rows[ROW_INDEXED], id)) {
+        z = index__zone(idx, zone);
+        if (!z)
+            return -1;
+        bit_set(z->jobs, id);
+        z->day_num = -1;
+        index__field(idx, ROW_MINUTE, crn_s->minute, MIN_MINUTE, MAX_MINUTE, id);
+        index__field(idx, ROW_HOUR, crn_s->hour, MIN_HOUR, MAX_HOUR, id);
+        index__field(idx, ROW_DOM, crn_s->day_of_month, MIN_DAY_OF_MONTH, MAX_DAY_OF_MONTH, id);
+        index__field(idx, ROW_MONTH, crn_s->month, MIN_MONTH, MAX_MONTH, id);
+        index__field(idx, ROW_DOW, crn_s->day_of_week, MIN_DAY_OF_WEEK, MAX_DAY_OF_WEEK, id);
+        if (crn_s->flags & CRON_DAY_OR)
+            bit_set(idx->rows[ROW_OR], id);
+        if ((crn_s->hour & ALL_HOURS) == ALL_HOURS)
+            bit_set(idx->rows[ROW_FOLLOW], id);
+        bit_set(idx->rows[ROW_INDEXED], id);
+        for (int v = MIN_MINUTE; v <= MAX_MINUTE; v++)
+            idx->minute_cnt[v] += crn_s->minute >> v & 1;
+    }
+    if (!bit_test(idx->rows[ROW_ARMED], id)) {
+        bit_set(idx->rows[ROW_ARMED], id);
+        ++idx->armed;
+    }
+    idx->when[id] = when;
+    return 0;
+}
+
+static void index_engine__remove(void *sched, size_t id)
+{
+    struct index *idx = sched;
+    size_t *due = __vec__at(idx->due, 0);
+    size_t len = vec__len_st(idx->due);
+    size_t kept = idx->due_pos;
+
+    if (id >= idx->nwords * 64 || !bit_test(idx->rows[ROW_INDEXED], id))
+        return;
+    for (int v = MIN_MINUTE; v <= MAX_MINUTE; v++)
+        idx->minute_cnt[v] -= bit_test(idx->rows[ROW_MINUTE + v], id);
+    if (bit_test(idx->rows[ROW_ARMED], id))
+        --idx->armed;
+    for (int i = 0; i < ROW_NUM; i++)
+        bit_clear(idx->rows[i], id);
+    for (size_t i = 0; i < vec__len_st(idx->zones); i++) {
+        struct index_zone *z = __vec__at(idx->zones, i);
+
+        bit_clear(z->jobs, id);
+        bit_clear(z->day, id);
+    }
+    /* it may be waiting to be popped */
+    for (size_t i = idx->due_pos; i < len; i++) {
+        if (due[i] != id)
+            due[kept++] = due[i];
+    }
+    vec__resize(idx->due, kept);
+}
+
+/*
+ * The first minute with jobs in the minute of the hour it reads as, in
+ * any zone, or the next offset change of a zone if that comes first. The
+ * hour and day are left to pop(), which may find nothing due there.
+ */
+static time_t index_engine__next(void *sched)
+{
+    struct index *idx = sched;
+    uint64_t minutes = 0;
+    time_t best = -1;
+
+    if (idx->due_pos < vec__len_st(idx->due))
+        return idx->cur - ONE_MIN;
+    if (!idx->armed)
+        return -1;
+    for (int v = MIN_MINUTE; v <= MAX_MINUTE; v++)
+        minutes |= (uint64_t)(idx->minute_cnt[v] != 0) << v;
+
+    for (size_t i = 0; i < vec__len_st(idx->zones); i++) {
+        struct index_zone *z = __vec__at(idx->zones, i);
+        struct clock_zone *zone = z->zone ? z->zone : clock__local_zone();
+        struct clock_range r;
+        time_t t = idx->cur;
+        int m;
+
+        if (!zone)
+            return idx->cur;
+        clock__range(zone, t, &r);
+        m = (t + r.off) / ONE_MIN % 60;
+        /* rotate so that bit 0 stands for the minute of cur */
+        if (m)
+            t += __builtin_ctzll(minutes >> m | minutes << (60 - m)) % 60 * ONE_MIN;
+        else
+            t += __builtin_ctzll(minutes) * ONE_MIN;
+        if (t > r.end && r.end > idx->cur)
+            t = r.end;
+        if (best == -1 || t < best)
+            best = t;
+    }
+    return best;
+}
+
+static int index_engine__pop(void *sched, time_t now, size_t *id)
+{
+    struct index *idx = sched;
+
+    while (idx->due_pos == vec__len_st(idx->due)) {
+        if (idx->cur > now)
+            return 0;
+        vec__resize(idx->due, 0);
+        idx->due_pos = 0;
+        if (index__tick(idx, idx->cur))
+            return -1;
+        idx->cur += ONE_MIN;
+    }
+    *id = *(size_t *)__vec__at(idx->due, idx->due_pos++);
+    return 1;
+}
+
+const struct engine index_engine = {
+    .name = "index",
+    .new = index_engine__new,
+    .free = index_engine__free,
+    .add = index_engine__add,
+    .remove = index_engine__remove,
+    .next = index_engine__next,
+    .pop = index_engine__pop,
+};
@@ -0,0 +1,108 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "launch.h"
+
+#define DEV_NULL "/dev/null"
+
+extern char **environ;
+
+/*
+ * posix_spawn doesn't copy the daemon's page tables (glibc uses
+ * clone(CLONE_VFORK)), so the cost of a launch doesn't grow with the size of
+ * the job table. Everything the child needs is described by the spawn
+ * attributes and file actions.
+ */
+static pid_t spawn_launch(char **argv, const struct launch_attr *attr)
+{
+    posix_spawnattr_t sa;
+    posix_spawn_file_actions_t fa;
+    short flags = POSIX_SPAWN_SETSIGMASK;
+    pid_t pid = -1;
+    int err;
+
+    if (posix_spawnattr_init(&sa))
+        return -1;
+    if (posix_spawn_file_actions_init(&fa)) {
+        posix_spawnattr_destroy(&sa);
+        return -1;
+    }
+
+#ifdef POSIX_SPAWN_USEVFORK
+    flags |= POSIX_SPAWN_USEVFORK;
+#endif
+    err = posix_spawnattr_setflags(&sa, flags);
+    if (!err)
+        err = posix_spawnattr_setsigmask(&sa, attr->sigmask);
+    /* jobs don't read the daemon's terminal */
+    if (!err)
+        err = posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, DEV_NULL, O_RDONLY, 0);
+    if (!err)
+        err = posix_spawnp(&pid, argv[0], &fa, &sa, argv, attr->envp ? attr->envp : environ);
+    if (err) {
+        pr_err("Failed to spawn %s: %s\n", argv[0], strerror(err));
+        pid = -1;
+    }
+
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&sa);
+    return pid;
+}
+
+/* the classic path, kept as a fallback */
+static pid_t fork_launch(char **argv, const struct launch_attr *attr)
+{
+    pid_t pid;
+
+    pid = fork();
+    if (pid == -1) {
+        pr_err("Failed to fork\n");
+        return -1;
+    } else if (pid == 0) {
+        int fd;
+
+        sigprocmask(SIG_SETMASK, attr->sigmask, NULL);
+        fd = open(DEV_NULL, O_RDONLY);
+        if (fd != -1 && fd != STDIN_FILENO) {
+            dup2(fd, STDIN_FILENO);
+            close(fd);
+        }
+        if (attr->envp)
+            environ = attr->envp;
+        execvp(argv[0], argv);
+        perror("execvp");
+        _exit(-1);
+    }
+    return pid;
+}
+
+const struct launcher spawn_launcher = {
+    .name = "spawn",
+    .launch = spawn_launch,
+};
+
+const struct launcher fork_launcher = {
+    .name = "fork",
+    .launch = fork_launch,
+};
+
+static const struct launcher *launchers[] = {
+    &spawn_launcher,
+    &fork_launcher,
+};
+
+/* NULL if there is no launcher with that name */
+const struct launcher *launcher__find(const char *name)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(launchers); i++) {
+        if (!strcmp(launchers[i]->name, name))
+            return launchers[i];
+    }
+    return NULL;
+}
@@ -0,0 +1,24 @@
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <signal.h>
+#include <sys/types.h>
+
+/* per launch settings, applied in the child before the command runs */
+struct launch_attr {
+    const sigset_t *sigmask;
+    char **envp; /* NULL to inherit the daemon's environment */
+};
+
+/* starts argv in the background, returns the pid or -1 */
+struct launcher {
+    const char *name;
+    pid_t (*launch)(char **argv, const struct launch_attr *attr);
+};
+
+extern const struct launcher spawn_launcher;
+extern const struct launcher fork_launcher;
+
+const struct launcher *launcher__find(const char *name);
+
+#endif
@@ -0,0 +1,784 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
+
+#include "util.h"
+#include "atoin.h"
+#include "cron.h"
+#include "vec.h"
+
+#define MAX_SCHED 61
+
+#define MIN_STEP 1
+
+extern char **environ;
+
+/* per thread, parser threads leave the reporting to the thread merging */
+static __thread bool parse_quiet;
+#define parse_err(...) do { if (!parse_quiet) pr_err(__VA_ARGS__); } while (0)
+
+/* stands for start, end, step */
+typedef struct Ses {
+    /*
+     * start and end act as temporary variables for parsing,
+     * do not represent the real start and end
+     */
+    // they describe the list element parsed last, start == end == -1
+    // means it was a bare *
+    int start;
+    int end;
+    uint64_t sched; /* bit i is set when value i is scheduled */
+} Ses;
+
+/* the next space separated token of [*pos, lim), 0 when there is none */
+static size_t get_next_tok(const char **pos, const char *lim, const char **tok)
+{
+    const char *start, *end;
+
+    /* find the first occurence of non-space */
+    for (start = *pos; start < lim && *start == ' '; ++start) {}
+    /* move till the first space */
+    for (end = start; end < lim && *end != ' '; ++end) {}
+
+    *tok = start;
+    *pos = end;
+    return end - start;
+}
+
+/* the character at pos, '\0' once the view ends at lim */
+static char peek(const char *pos, const char *lim)
+{
+    return pos < lim ? *pos : '\0';
+}
+
+static int check_bound(const int mn, const int mx, const int val)
+{
+    if (mn <= val && val <= mx)
+        return 1;
+    return 0;
+}
+
+static bool is_astr(const Ses *ses)
+{
+    return ses->start == -1 && ses->end == -1;
+}
+
+static char zero[] = "0";
+static int is_legal(int tmp, const char *pos, size_t n) {
+    return !(tmp == 0 && strncmp(pos, zero, min(sizeof(zero), n)));
+}
+
+static void ses__write_sched(Ses *ses, const int _start, const int _end, const int step)
+{
+    const int start = max(0, _start);
+    const int end = min(MAX_SCHED - 1, (_end == -1 ? MAX_SCHED - 1 : _end));
+
+    pr_debug("start %d end %d\n", _start, _end);
+    if (step < MIN_STEP) {
+        parse_err("step can't be %d\n", step);
+        return;
+    }
+    for (int i = start; i <= end; i += step)
+        ses->sched |= 1ULL << i;
+}
+
+static int parse_ses(const char **pos, const char *lim, Ses *ses, int min_val, int max_val);
+
+static int parse_step(const char **pos, const char *lim)
+{
+    int step;
+
+    if (isdigit(peek(*pos, lim))) { // step
+        const char *end = NULL;
+        for (end = *pos; end < lim && isdigit(*end); ++end) {}
+        step = atoin(*pos, end - *pos);
+        if (!is_legal(step, *pos, end - *pos)) {
+            parse_err("Can't be converted to integer\n");
+            return -1;
+        }
+        *pos = end;
+    } else {
+        parse_err("\'/\' should be followed with a number\n");
+        return -1;
+    }
+    if (step < MIN_STEP) {
+        parse_err("step can't be %d\n", step);
+        return -1;
+    }
+    return step;
+}
+
+static int parse_num_lhs(const char **pos, const char *lim, Ses *ses, int min_val, int max_val)
+{
+    const char *end = NULL;
+
+    // consumes the number
+    for (end = *pos; end < lim && isdigit(*end); ++end) {}
+    int tmp = atoin(*pos, end - *pos);
+    if (!is_legal(tmp, *pos, end - *pos)) {
+        parse_err("Can't be converted to integer\n");
+        return -1;
+    }
+    if (!check_bound(min_val, max_val, tmp)) {
+        parse_err("Value %d out of range [%d, %d]\n", tmp, min_val, max_val);
+        return -1;
+    }
+    *pos = end;
+    ses->start = tmp;
+
+    if (!peek(*pos, lim)) {
+        ses__write_sched(ses, ses->start, ses->start, MIN_STEP);
+        return 0;
+    } else if (peek(*pos, lim) == '-') {
+        ++*pos;
+        if (isdigit(peek(*pos, lim))) {
+            const char *end = NULL;
+
+            for (end = *pos; end < lim && isdigit(*end); ++end) {}
+            tmp = atoin(*pos, end - *pos);
+            if (!is_legal(tmp, *pos, end - *pos)) {
+                parse_err("Can't be converted to integer\n");
+                return -1;
+            }
+            if (!check_bound(min_val, max_val, tmp)) {
+                parse_err("Value %d out of range [%d, %d]\n", tmp, min_val, max_val);
+                return -1;
+            }
+            if (tmp < ses->start) {
+                parse_err("Range end %d is less than start %d\n", tmp, ses->start);
+                return -1;
+            }
+            *pos = end;
+            ses->end = tmp;
+
+            if (peek(*pos, lim) == '/') {
+                int step;
+
+                ++*pos;
+                step = parse_step(pos, lim);
+                if (step == -1)
+                    return -1;
+                ses__write_sched(ses, ses->start, ses->end, step);
+
+                if (peek(*pos, lim) == ',') {
+                    ++*pos;
+                    if (parse_ses(pos, lim, ses, min_val, max_val))
+                        return -1;
+                } else if (peek(*pos, lim)) {
+                    parse_err("Illegal character(%c)\n", peek(*pos, lim));
+                    pr_debug("Illegal char on line %d\n", __LINE__);
+                    return -1;
+                }
+            } else if (peek(*pos, lim) == ',') {
+                ses__write_sched(ses, ses->start, ses->end, MIN_STEP);
+                ++*pos;
+                if (parse_ses(pos, lim, ses, min_val, max_val))
+                    return -1;
+            } else if (!peek(*pos, lim)) {
+                ses__write_sched(ses, ses->start, ses->end, MIN_STEP);
+                return 0;
+            } else {
+                parse_err("Illegal character(%c)\n", peek(*pos, lim));
+                pr_debug("Illegal char on line %d\n", __LINE__);
+                return -1;
+            }
+        } else if (peek(*pos, lim) == '*') {
+            ++*pos;
+            ses->end = -1;
+            if (peek(*pos, lim) == '/') {
+                int step;
+
+                ++*pos;
+                step = parse_step(pos, lim);
+                if (step == -1)
+                    return -1;
+                ses__write_sched(ses, ses->start, ses->end, step);
+
+                if (peek(*pos, lim) == ',') {
+                    ++*pos;
+                    if (parse_ses(pos, lim, ses, min_val, max_val))
+                        return -1;
+                } else if (peek(*pos, lim)) {
+                    parse_err("Illegal character(%c)\n", peek(*pos, lim));
+                    pr_debug("Illegal char on line %d\n", __LINE__);
+                    return -1;
+                }
+            } else if (!peek(*pos, lim)) {
+                ses__write_sched(ses, ses->start, ses->end, MIN_STEP);
+                return 0;
+            } else if (peek(*pos, lim) == ',') {
+                ses__write_sched(ses, ses->start, ses->end, MIN_STEP);
+                ++*pos;
+                if (parse_ses(pos, lim, ses, min_val, max_val))
+                    return -1;
+            } else {
+                parse_err("Illegal character(%c)\n", peek(*pos, lim));
+                pr_debug("Illegal char on line %d\n", __LINE__);
+                return -1;
+            }
+        } else {
+            parse_err("Illegal character(%c)\n", peek(*pos, lim));
+            pr_debug("Illegal char on line %d\n", __LINE__);
+            return -1;
+        }
+    } else if (peek(*pos, lim) == ',') {
+        ses__write_sched(ses, ses->start, ses->start, MIN_STEP);
+        ++*pos;
+        if (parse_ses(pos, lim, ses, min_val, max_val))
+            return -1;
+    } else if (peek(*pos, lim) == '/') {
+        int step;
+
+        ++*pos;
+        step = parse_step(pos, lim);
+        if (step == -1)
+            return -1;
+        ses__write_sched(ses, ses->start, -1, step);
+
+        if (peek(*pos, lim) == ',') {
+            ++*pos;
+            if (parse_ses(pos, lim, ses, min_val, max_val))
+                return -1;
+        } else if (peek(*pos, lim)) {
+            parse_err("Illegal character(%c)\n", peek(*pos, lim));
+            pr_debug("Illegal char on line %d\n", __LINE__);
+            return -1;
+        }
+    } else {
+        parse_err("Illegal character(%c)\n", peek(*pos, lim));
+        pr_debug("Illegal char on line %d\n", __LINE__);
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_asterisk_lhs(const char **pos, const char *lim, Ses *ses, int min_val, int max_val)
+{
+    ++*pos;
+    ses->start = -1;
+    if (peek(*pos, lim) == ',') {
+        ses->end = -1;
+        ses__write_sched(ses, ses->start, ses->start, MIN_STEP);
+        ++*pos;
+        if (parse_ses(pos, lim, ses, min_val, max_val))
+            return -1;
+    } else if (peek(*pos, lim) == '-') {
+        ++*pos;
+        if (isdigit(peek(*pos, lim))) {
+            const char *end = NULL;
+            for (end = *pos; end < lim && isdigit(*end); ++end) {}
+            int tmp = atoin(*pos, end - *pos);
+            if (!is_legal(tmp, *pos, end - *pos)) {
+                parse_err("Can't be converted to integer\n");
+                return -1;
+            }
+            if (!check_bound(min_val, max_val, tmp)) {
+                parse_err("Value %d out of range [%d, %d]\n", tmp, min_val, max_val);
+                return -1;
+            }
+            *pos = end;
+            ses->end = tmp;
+
+            if (peek(*pos, lim) == '/') {
+                int step;
+
+                ++*pos;
+                step = parse_step(pos, lim);
+                if (step == -1)
+                    return -1;
+                ses__write_sched(ses, ses->start, ses->end, step);
+
+                if (peek(*pos, lim) == ',') {
+                    ++*pos;
+                    if (parse_ses(pos, lim, ses, min_val, max_val))
+                        return -1;
+                } else if (peek(*pos, lim)) {
+                    parse_err("Illegal character(%c)\n", peek(*pos, lim));
+                    pr_debug("Illegal char on line %d\n", __LINE__);
+                    return -1;
+                }
+            } else if (peek(*pos, lim) == ',') {
+                ses__write_sched(ses, ses->start, ses->end, MIN_STEP);
+                ++*pos;
+                if (parse_ses(pos, lim, ses, min_val, max_val))
+                    return -1;
+            } else if (!peek(*pos, lim)) {
+                ses__write_sched(ses, ses->start, ses->end, MIN_STEP);
+                return 0;
+            } else {
+                parse_err("Illegal character(%c)\n", peek(*pos, lim));
+                pr_debug("Illegal char on line %d\n", __LINE__);
+                return -1;
+            }
+        } else {
+            parse_err("Illegal character(%c)\n", peek(*pos, lim));
+            pr_debug("Illegal char on line %d\n", __LINE__);
+            return -1;
+        }
+    } else if (!peek(*pos, lim)) {
+        // single asterisk, it's gonna be -1 -1
+        ses->end = -1;
+        ses__write_sched(ses, ses->start, ses->start, MIN_STEP);
+        return 0;
+    } else if (peek(*pos, lim) == '/') {
+        int step;
+
+        ++*pos;
+        step = parse_step(pos, lim);
+        if (step == -1)
+            return -1;
+        ses__write_sched(ses, ses->start, ses->start, step);
+
+        if (peek(*pos, lim) == ',') {
+            ++*pos;
+            if (parse_ses(pos, lim, ses, min_val, max_val))
+                return -1;
+        } else if (peek(*pos, lim)) {
+            parse_err("Illegal character(%c)\n", peek(*pos, lim));
+            pr_debug("Illegal char on line %d\n", __LINE__);
+            return -1;
+        }
+    } else {
+        parse_err("Illegal character(%c)\n", peek(*pos, lim));
+        pr_debug("Illegal char on line %d\n", __LINE__);
+        return -1;
+    }
+    return 0;
+}
+
+/* caller will clear ses */
+static int parse_ses(const char **pos, const char *lim, Ses *ses, int min_val, int max_val)
+{
+    int err = 0;
+
+    if (pos == NULL || ses == NULL)
+        return -1;
+    /* nothing of the previous element carries over into is_astr() */
+    ses->start = 0;
+    ses->end = 0;
+
+    /*
+    $root:
+        (num | *)
+        $num:
+            (end | - | , | /)
+            $-:
+                (num | *)
+                $num, $*:
+                    (/ | , | end)
+                    $/:
+                        (step | ,)
+                        $step:
+                            (end)
+                        $,:
+                            (root)
+                    $,:
+                        (root)
+            $,:
+                (root)
+            $/:
+                (step | ,)
+                $step:
+                    (end)
+                $,:
+                    (root)
+        $*:
+            (, | - | end | /)
+            $,:
+                (root)
+            $-:
+                (num)
+                $num:
+                    (/ | , | end)
+                    $/:
+                        (step | ,)
+                        $step:
+                            (end)
+                        $,:
+                            (root)
+                    $,:
+                        (root)
+            $/:
+                (step | ,)
+                $step:
+                    (end)
+                $,:
+                    (root)
+    */
+
+    if (isdigit(peek(*pos, lim))) {
+        err = parse_num_lhs(pos, lim, ses, min_val, max_val);
+        if (err)
+            return err;
+    } else if (peek(*pos, lim) == '*') {
+        err = parse_asterisk_lhs(pos, lim, ses, min_val, max_val);
+        if (err)
+            return err;
+    } else {
+        parse_err("Illegal character(%c)\n", peek(*pos, lim));
+        pr_debug("Illegal char on line %d\n", __LINE__);
+        return -1;
+    }
+    return 0;
+}
+
+#ifdef DEBUG
+/*
+ * writes a ranges string only for debug purposes
+ */
+static void ses__get_ranges(const Ses *ses, char *ranges, size_t size)
+{
+    int prev_start = -1;
+
+    for (int i = 0; i < MAX_SCHED; i++) {
+        if (ses->sched & 1ULL << i) {
+            if (prev_start == -1)
+                prev_start = i;
+        } else if (prev_start != -1) {
+            int written = snprintf(ranges, size, "%d-%d ", prev_start, i - 1);
+            if (written < 0 || (size_t)written >= size)
+                return;
+            ranges += written;
+            size -= written;
+            prev_start = -1;
+        }
+    }
+    /* flush a range that extends to the last slot */
+    if (prev_start != -1)
+        snprintf(ranges, size, "%d-%d ", prev_start, MAX_SCHED - 1);
+}
+#endif /* DEBUG */
+
+static const struct {
+    const char *name;
+    int min_val;
+    int max_val;
+} fields[CRON_NUM] = {
+    { "minute", MIN_MINUTE, MAX_MINUTE },
+    { "hour", MIN_HOUR, MAX_HOUR },
+    { "day_of_month", MIN_DAY_OF_MONTH, MAX_DAY_OF_MONTH },
+    { "month", MIN_MONTH, MAX_MONTH },
+    { "day_of_week", MIN_DAY_OF_WEEK, MAX_DAY_OF_WEEK },
+};
+
+/* the scheduled values of ses that fall into [min_val, max_val] */
+static uint64_t ses__mask(const Ses *ses, int idx)
+{
+    return ses->sched & (~0ULL >> (63 - fields[idx].max_val)) & (~0ULL << fields[idx].min_val);
+}
+
+/* every value of the field is scheduled */
+static bool mask__full(uint64_t mask, int idx)
+{
+    return mask == ((~0ULL >> (63 - fields[idx].max_val)) & (~0ULL << fields[idx].min_val));
+}
+
+/* see enum cron_shape */
+static uint8_t ses__shape(const cron_set *crn_s)
+{
+    bool mday = mask__full(crn_s->day_of_month, 2) && mask__full(crn_s->month, 3);
+    bool wday = mask__full(crn_s->day_of_week, 4);
+    bool every_day = crn_s->flags & CRON_DAY_OR ? mday || wday : mday && wday;
+
+    if (!every_day)
+        return CRON_SHAPE_ANY;
+    if (!mask__full(crn_s->hour, 1))
+        return CRON_SHAPE_DAILY;
+    if (!mask__full(crn_s->minute, 0))
+        return CRON_SHAPE_HOURLY;
+    return CRON_SHAPE_EVERY_MINUTE;
+}
+
+/* turns the parsed fields into bitmasks, resolving the day rule up front */
+static void ses__compile(const Ses *ses, cron_set *crn_s)
+{
+    const Ses *dom = &ses[2], *mon = &ses[3], *dow = &ses[4];
+
+    crn_s->minute = ses__mask(&ses[0], 0);
+    crn_s->hour = ses__mask(&ses[1], 1);
+    crn_s->day_of_month = ses__mask(dom, 2);
+    crn_s->month = ses__mask(mon, 3);
+    crn_s->day_of_week = ses__mask(dow, 4);
+
+    /*
+     * 1. If month, day of month, and day of week are all <asterisk> characters,
+     *    every day shall be matched.
+     *
+     * 2. month=elem/list or mday=elem/list, wday *, month and mday determines
+     *
+     * 3. month and mday both*, wday=elem/list, wday determines
+     *
+     * 4. If either month or mday is elem/list, wday is elem/list, any day either
+     *    the month and day of month, or day of week shall match
+     *
+     * A field counts as an asterisk when its last element is a bare *,
+     * which sets every bit, so 1-3 all come down to
+     * (mday && month && wday), only 4 needs the OR. A list that ends in a
+     * stepped asterisk isn't one, its mask takes part like any other list.
+     */
+    crn_s->flags = 0;
+    if ((!is_astr(mon) || !is_astr(dom)) && !is_astr(dow))
+        crn_s->flags |= CRON_DAY_OR;
+    crn_s->shape = ses__shape(crn_s);
+}
+
+static int get_next_arg(const char **pos, const char *lim, const char **arg, size_t *arg_len)
+{
+    /*
+    // for every occurence of space, one need to consume all of them
+    $root
+        (" | char | ' ')
+        $":
+            (" | ANY OTHER THAN '"')
+            $":
+                (root | end)
+            $ANY OTHER THAN '"':
+                (")
+                    $":
+                        (end)
+        $char:
+            (' ' | end)
+            $' ':
+                (root)
+        $' '
+            (root)
+    */
+    char sep;
+    const char *end = NULL;
+
+    if (!pos || !*pos)
+        return -1;
+
+    /* allows multiple spaces, go to the first non-space character */
+    end = *pos;
+    while (end < lim && *end == ' ')
+        ++end;
+    if (end == lim)
+        return -1;
+    *pos = end;
+
+    if (**pos == '"') {
+        sep = '"';
+        ++*pos;
+    } else if (**pos == '\'') {
+        sep = '\'';
+        ++*pos;
+    } else {
+        sep = ' ';
+    }
+
+    end = *pos;
+    while (end < lim && *end != sep)
+        ++end;
+    if (sep != ' ' && end == lim) { /* hits the end without the matching quote */
+        parse_err("Missing the closing %c\n", sep);
+        return -2;
+    }
+
+    *arg = *pos;
+    *arg_len = end - *pos;
+    if (sep == ' ')
+        *pos = end;
+    else
+        *pos = end + 1;
+    return 0;
+}
+
+/*
+ * Splits the command into arguments once at parse time. The argv array and
+ * the strings share one allocation from a, pointers first, so that launching
+ * a job doesn't allocate and one free releases everything.
+ */
+static char **parse_argv(const char *comm, const char *lim, struct allocator *a)
+{
+    const char *pos = comm;
+    const char *arg;
+    size_t arg_len;
+    size_t argc = 0;
+    size_t bytes = 0;
+    char **argv;
+    char *str;
+    int err;
+
+    while (!(err = get_next_arg(&pos, lim, &arg, &arg_len))) {
+        ++argc;
+        bytes += arg_len + 1;
+    }
+    if (err == -2)
+        return NULL;
+    if (argc == 0) {
+        parse_err("Empty command\n");
+        return NULL;
+    }
+
+    argv = mem__alloc(a, (argc + 1) * sizeof(char *) + bytes);
+    if (!argv) {
+        pr_err("Failed to allocate argument buffer\n");
+        return NULL;
+    }
+
+    str = (char *)(argv + argc + 1);
+    pos = comm;
+    for (size_t idx = 0; idx < argc; idx++) {
+        get_next_arg(&pos, lim, &arg, &arg_len);
+        memcpy(str, arg, arg_len);
+        str[arg_len] = '\0';
+        argv[idx] = str;
+        str += arg_len + 1;
+        pr_debug("arg[%zu] = %s\n", idx, argv[idx]);
+    }
+    argv[argc] = NULL;
+    return argv;
+}
+
+/* errors of the calling thread's parses aren't printed while quiet is set */
+void parse_set_quiet(bool quiet)
+{
+    parse_quiet = quiet;
+}
+
+/*
+ * Parses the line [line, line + len), it doesn't have to be NUL terminated
+ * and nothing is copied but the arguments, into an allocation of a (NULL
+ * for malloc)
+ */
+int parse(const char *line, size_t len, cron_set *crn_s, char ***argv, struct allocator *a)
+{
+    const char *pos = line;
+    const char *lim = line + len;
+    const char *tok;
+    size_t tok_len;
+    int cnt = 0;
+    Ses ses[CRON_NUM];
+
+    memset(ses, 0, sizeof(ses));
+
+    for (int idx = 0;
+         idx < CRON_NUM && (tok_len = get_next_tok(&pos, lim, &tok));
+         ++idx, ++cnt) {
+        int err;
+        const char *field = tok;
+
+        err = parse_ses(&field, tok + tok_len, &ses[idx], fields[idx].min_val, fields[idx].max_val);
+        if (err)
+            return err;
+        /* a NUL byte stops the field parser early */
+        if (field != tok + tok_len) {
+            parse_err("Illegal character(%c)\n", *field);
+            return -1;
+        }
+#ifdef DEBUG
+        char ranges[256] = { 0 };
+
+        ses__get_ranges(&ses[idx], ranges, sizeof(ranges));
+        pr_debug("\033[35m" "%-16s ranges: %s\n" "\033[0m", fields[idx].name, ranges[0] == 0 ? "All" : ranges);
+#endif
+    }
+
+    // go to the first non-space
+    for (; pos < lim && *pos == ' '; ++pos) {}
+
+    if (pos == lim) {
+        parse_err("Empty command\n");
+        return -1;
+    }
+
+    if (cnt < CRON_NUM) {
+        parse_err("Only has %d numbers, needs to be %d\n", cnt, CRON_NUM);
+        return -1;
+    }
+
+    *argv = parse_argv(pos, lim, a);
+    if (!*argv)
+        return -1;
+    ses__compile(ses, crn_s);
+    return 0;
+}
+
+/*
+ * Assignments (NAME=value) apply to the entries that follow them. Returns 1
+ * if the line isn't an assignment, the name and value point into line.
+ */
+int parse_assign(const char *line, size_t len, struct cron_assign *assign)
+{
+    const char *lim = line + len;
+    const char *name = line;
+    const char *value;
+    size_t name_len;
+    size_t value_len;
+
+    for (; name < lim && *name == ' '; ++name) {}
+    if (name == lim || (!isalpha(*name) && *name != '_'))
+        return 1;
+    for (name_len = 0; name + name_len < lim &&
+         (isalnum(name[name_len]) || name[name_len] == '_'); ++name_len) {}
+
+    for (value = name + name_len; value < lim && *value == ' '; ++value) {}
+    if (value == lim || *value != '=')
+        return 1;
+    for (++value; value < lim && *value == ' '; ++value) {}
+    value_len = lim - value;
+    /* drop matching quotes around the value */
+    if (value_len >= 2 && (*value == '"' || *value == '\'') && value[value_len - 1] == *value) {
+        ++value;
+        value_len -= 2;
+    }
+
+    assign->name = name;
+    assign->name_len = name_len;
+    assign->value = value;
+    assign->value_len = value_len;
+    return 0;
+}
+
+/*
+ * Returns a copy of base (environ when base is NULL) with the variable of
+ * assign set, in a single allocation of a like argv, or NULL if out of memory
+ */
+char **env_set(char **base, const struct cron_assign *assign, struct allocator *a)
+{
+    size_t name_len = assign->name_len;
+    size_t value_len = assign->value_len;
+    size_t envc = 0;
+    size_t bytes;
+    char **env;
+    char *str;
+
+    if (!base)
+        base = environ;
+    bytes = name_len + 1 + value_len + 1;
+    for (char **var = base; *var; ++var) {
+        ++envc;
+        bytes += strlen(*var) + 1;
+    }
+
+    env = mem__alloc(a, (envc + 2) * sizeof(char *) + bytes);
+    if (!env) {
+        pr_err("Failed to allocate the environment\n");
+        return NULL;
+    }
+
+    str = (char *)(env + envc + 2);
+    envc = 0;
+    for (char **var = base; *var; ++var) {
+        size_t len = strlen(*var);
+
+        /* replaced by the new value */
+        if (!strncmp(*var, assign->name, name_len) && (*var)[name_len] == '=')
+            continue;
+        memcpy(str, *var, len + 1);
+        env[envc++] = str;
+        str += len + 1;
+    }
+    memcpy(str, assign->name, name_len);
+    str[name_len] = '=';
+    memcpy(str + name_len + 1, assign->value, value_len);
+    str[name_len + 1 + value_len] = '\0';
+    env[envc++] = str;
+    env[envc] = NULL;
+
+    pr_debug("Set %s\n", str);
+    return env;
+}
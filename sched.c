@@ -0,0 +1,268 @@
+#include <stdbool.h>
+#include <time.h>
+
+#include "cron.h"
+#include "clock.h"
+
+/* how far ahead to look for a fire time, Feb 29 can be 8 years away */
+#define LOOKAHEAD (9 * 366 * 24 * 60 * 60L)
+#define ONE_MIN 60
+#define ONE_HOUR (60 * 60)
+#define ONE_DAY (24 * 60 * 60L)
+#define ALL_HOURS ((1U << (MAX_HOUR + 1)) - 1)
+
+/* lowest set bit of mask at or above bit, -1 if there is none */
+static int next_bit(uint64_t mask, int bit)
+{
+    if (bit > 63)
+        return -1;
+    mask &= ~0ULL << bit;
+    return mask ? __builtin_ctzll(mask) : -1;
+}
+
+/* see ses__compile() for how the day rule is folded into the masks */
+bool cron__day_match(const cron_set *crn_s, const struct tm *info)
+{
+    bool mday_ret = (crn_s->day_of_month & 1U << info->tm_mday) &&
+                    (crn_s->month & 1U << (info->tm_mon + 1));
+    bool wday_ret = crn_s->day_of_week & 1U << (info->tm_wday + 1);
+
+    if (crn_s->flags & CRON_DAY_OR)
+        return mday_ret || wday_ret;
+    return mday_ret && wday_ret;
+}
+
+static int cron__match_any(const cron_set *crn_s, const struct tm *info)
+{
+    if (!(crn_s->minute & 1ULL << info->tm_min) ||
+        !(crn_s->hour & 1U << info->tm_hour))
+        return 0;
+
+    return cron__day_match(crn_s, info);
+}
+
+static int cron__match_every_minute(const cron_set *crn_s, const struct tm *info)
+{
+    (void)crn_s;
+    (void)info;
+    return 1;
+}
+
+static int cron__match_hourly(const cron_set *crn_s, const struct tm *info)
+{
+    return crn_s->minute >> info->tm_min & 1;
+}
+
+static int cron__match_daily(const cron_set *crn_s, const struct tm *info)
+{
+    return crn_s->minute >> info->tm_min & crn_s->hour >> info->tm_hour & 1;
+}
+
+/*
+ * The first wall clock minute at or after w and before limit that crn_s
+ * matches, -1 if there is none. Instead of stepping minute by minute, it
+ * skips whole months, days and hours whose bit is not set.
+ */
+static time_t cron__next_wall(const cron_set *crn_s, time_t w, time_t limit)
+{
+    struct tm info;
+
+    if (w % ONE_MIN)
+        w += ONE_MIN - w % ONE_MIN;
+    while (w < limit) {
+        int bit;
+
+        clock__civil(w, &info);
+        if (!cron__day_match(crn_s, &info)) {
+            /* without the OR rule a month that doesn't match can't fire */
+            if (!(crn_s->flags & CRON_DAY_OR) &&
+                !(crn_s->month & 1U << (info.tm_mon + 1))) {
+                info.tm_mon++;
+                info.tm_mday = 1;
+            } else {
+                info.tm_mday++;
+            }
+            info.tm_hour = 0;
+            info.tm_min = 0;
+        } else if ((bit = next_bit(crn_s->hour, info.tm_hour)) != info.tm_hour) {
+            if (bit == -1) {
+                info.tm_mday++;
+                info.tm_hour = 0;
+            } else {
+                info.tm_hour = bit;
+            }
+            info.tm_min = 0;
+        } else if ((bit = next_bit(crn_s->minute, info.tm_min)) != info.tm_min) {
+            if (bit == -1) {
+                info.tm_hour++;
+                info.tm_min = 0;
+            } else {
+                info.tm_min = bit;
+            }
+        } else {
+            return w;
+        }
+        w = clock__civil_secs(&info);
+    }
+    return -1;
+}
+
+/* the wall clock is searched one span of constant UTC offset at a time */
+static time_t cron__next_any(const cron_set *crn_s, struct clock_zone *zone, time_t after)
+{
+    struct clock_range r;
+    time_t t, limit;
+    bool follow;
+
+    follow = (crn_s->hour & ALL_HOURS) == ALL_HOURS;
+
+    t = after - after % ONE_MIN + ONE_MIN;
+    limit = t + LOOKAHEAD;
+
+    while (t < limit) {
+        time_t w, end;
+
+        clock__range(zone, t, &r);
+        end = r.end < limit ? r.end : limit;
+        if (!follow && t == r.start && r.prev_off < r.off &&
+            cron__next_wall(crn_s, r.start + r.prev_off, r.start + r.off) != -1)
+            return t;
+
+        w = t + r.off;
+        /* the times before the clock went back were read already */
+        if (!follow && r.prev_off > r.off && w < r.start + r.prev_off)
+            w = r.start + r.prev_off;
+        w = cron__next_wall(crn_s, w, end + r.off);
+        if (w != -1)
+            return w - r.off;
+        t = end;
+    }
+    return -1;
+}
+
+/*
+ * Every hour of every day: the minute of the hour decides, the next one is
+ * found with arithmetic on the offset of each span instead of a search.
+ * These jobs follow the clock, nothing special happens around changes.
+ */
+static time_t cron__next_hourly(const cron_set *crn_s, struct clock_zone *zone, time_t after)
+{
+    struct clock_range r;
+    time_t t = after - after % ONE_MIN + ONE_MIN;
+
+    while (1) {
+        time_t w;
+        int min, bit;
+
+        clock__range(zone, t, &r);
+        w = t + r.off;
+        if (w % ONE_MIN)
+            w += ONE_MIN - w % ONE_MIN;
+        min = w / ONE_MIN % 60;
+        bit = next_bit(crn_s->minute, min);
+        if (bit == -1)
+            bit = 60 + __builtin_ctzll(crn_s->minute);
+        w += (bit - min) * ONE_MIN;
+        if (w - r.off < r.end)
+            return w - r.off;
+        t = r.end;
+    }
+}
+
+/*
+ * Every day: the time of day decides, unless the offset changes before it
+ * or the span starts with one of the special cases of DST, which are left
+ * to the search.
+ */
+static time_t cron__next_daily(const cron_set *crn_s, struct clock_zone *zone, time_t after)
+{
+    struct clock_range r;
+    time_t t = after - after % ONE_MIN + ONE_MIN;
+    time_t w, day;
+    int hour, min, bit;
+
+    clock__range(zone, t, &r);
+    w = t + r.off;
+    if ((t == r.start && r.prev_off < r.off) ||
+        (r.prev_off > r.off && w < r.start + r.prev_off))
+        return cron__next_any(crn_s, zone, after);
+    if (w % ONE_MIN)
+        w += ONE_MIN - w % ONE_MIN;
+    day = w - w % ONE_DAY;
+    hour = (w - day) / ONE_HOUR;
+    min = (w - day) / ONE_MIN % 60;
+
+    if (crn_s->hour >> hour & 1 && (bit = next_bit(crn_s->minute, min)) != -1) {
+        w = day + hour * ONE_HOUR + bit * ONE_MIN;
+    } else {
+        w = day + __builtin_ctzll(crn_s->minute) * ONE_MIN;
+        bit = next_bit(crn_s->hour, hour + 1);
+        if (bit == -1)
+            w += ONE_DAY + __builtin_ctz(crn_s->hour) * ONE_HOUR;
+        else
+            w += bit * ONE_HOUR;
+    }
+    if (w - r.off < r.end)
+        return w - r.off;
+    return cron__next_any(crn_s, zone, after);
+}
+
+/* how each enum cron_shape matches and finds its next fire */
+static const struct cron_shape_ops {
+    int (*match)(const cron_set *crn_s, const struct tm *info);
+    time_t (*next)(const cron_set *crn_s, struct clock_zone *zone, time_t after);
+} shape_ops[CRON_SHAPE_NUM] = {
+    [CRON_SHAPE_ANY] = { cron__match_any, cron__next_any },
+    [CRON_SHAPE_EVERY_MINUTE] = { cron__match_every_minute, cron__next_hourly },
+    [CRON_SHAPE_HOURLY] = { cron__match_hourly, cron__next_hourly },
+    [CRON_SHAPE_DAILY] = { cron__match_daily, cron__next_daily },
+};
+
+static const struct cron_shape_ops *cron__shape_ops(const cron_set *crn_s)
+{
+    return &shape_ops[crn_s->shape < CRON_SHAPE_NUM ? crn_s->shape : CRON_SHAPE_ANY];
+}
+
+/*
+ * The matcher of the shape of crn_s, for going through many schedules of
+ * one shape without deciding how to match each of them
+ */
+cron_match_fn cron__matcher(const cron_set *crn_s)
+{
+    return cron__shape_ops(crn_s)->match;
+}
+
+/*
+ * Returns a positive number when cron should exec. Only schedules that
+ * don't run every day need the day rule.
+ */
+int cron__should_exec(const cron_set *crn_s, const struct tm *info)
+{
+    if (!crn_s || !info)
+        return 0;
+
+    if (!(crn_s->minute & 1ULL << info->tm_min) ||
+        !(crn_s->hour & 1U << info->tm_hour))
+        return 0;
+
+    return crn_s->shape != CRON_SHAPE_ANY || cron__day_match(crn_s, info);
+}
+
+/*
+ * Returns the first minute strictly after `after` that crn_s matches in
+ * zone (the process' zone if NULL), or -1 when it never fires.
+ *
+ * A job with every hour set follows the clock, it fires at whatever
+ * minute reads as one of its times, twice in the hour repeated when DST
+ * ends and not at all in the hour skipped when it starts. Any other job
+ * fires once per wall clock time: only the first time a repeated time is
+ * read, and at the end of the gap for times that are skipped.
+ */
+time_t cron_next_fire(const cron_set *crn_s, struct clock_zone *zone, time_t after)
+{
+    if (!zone)
+        zone = clock__local_zone();
+    if (!crn_s || !crn_s->minute || !crn_s->hour || !zone)
+        return -1;
+    return cron__shape_ops(crn_s)->next(crn_s, zone, after);
+}
@@ -0,0 +1,156 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "vec.h"
+#include "share.h"
+
+/* a vector header, or the buffer of up to 4 job ids (it grows 16, 32, 64 bytes) */
+#define SHARE_LIST_SIZE 48
+
+int share__init(struct share_tab *st)
+{
+    memset(st, 0, sizeof(*st));
+    pool__init(&st->lists, SHARE_LIST_SIZE);
+    st->sets = vec__new(sizeof(cron_set));
+    st->shares = vec__new(sizeof(struct share));
+    st->free_ids = vec__new(sizeof(size_t));
+    st->added = vec__new(sizeof(size_t));
+    st->removed = vec__new(sizeof(size_t));
+    if (!st->sets || !st->shares || !st->free_ids || !st->added || !st->removed || hmap__init(&st->keys)) {
+        share__free(st);
+        return -1;
+    }
+    return 0;
+}
+
+void share__free(struct share_tab *st)
+{
+    for (size_t i = 0; st->shares && i < vec__len_st(st->shares); i++)
+        vec__free(((struct share *)__vec__at(st->shares, i))->jobs);
+    vec__free(st->sets);
+    vec__free(st->shares);
+    vec__free(st->free_ids);
+    vec__free(st->added);
+    vec__free(st->removed);
+    hmap__free(&st->keys);
+    pool__free(&st->lists);
+    memset(st, 0, sizeof(*st));
+}
+
+/* starts collecting the shares created and emptied anew */
+void share__begin(struct share_tab *st)
+{
+    vec__resize(st->added, 0);
+    vec__resize(st->removed, 0);
+}
+
+/* field by field, the padding of a cron_set is left out */
+static uint64_t share__hash(const cron_set *crn_s, struct clock_zone *zone)
+{
+    uint64_t h = HASH_SEED;
+
+    h = hash__mix(h, crn_s->minute);
+    h = hash__mix(h, (uint64_t)crn_s->hour << 32 | crn_s->day_of_month);
+    h = hash__mix(h, (uint64_t)crn_s->month << 16 | crn_s->day_of_week << 8 | crn_s->flags);
+    return hash__mix(h, (uintptr_t)zone);
+}
+
+static bool share__same(const struct share_tab *st, size_t id, const cron_set *crn_s,
+                        struct clock_zone *zone)
+{
+    const cron_set *s = __vec__at(st->sets, id);
+    const struct share *share = __vec__at(st->shares, id);
+
+    return s->minute == crn_s->minute && s->hour == crn_s->hour &&
+           s->day_of_month == crn_s->day_of_month && s->month == crn_s->month &&
+           s->day_of_week == crn_s->day_of_week && s->flags == crn_s->flags &&
+           share->zone == zone;
+}
+
+static int share__new(struct share_tab *st, const cron_set *crn_s, struct clock_zone *zone,
+                      uint64_t key, size_t *id)
+{
+    struct share share = { .zone = zone, .next = -1 };
+
+    share.jobs = vec__new_in(sizeof(size_t), &st->lists.base);
+    if (!share.jobs)
+        return -1;
+    if (!vec__is_empty(st->free_ids)) {
+        *id = *(size_t *)__vec__at(st->free_ids, vec__len_st(st->free_ids) - 1);
+        vec__pop(st->free_ids);
+        *(cron_set *)__vec__at(st->sets, *id) = *crn_s;
+        *(struct share *)__vec__at(st->shares, *id) = share;
+    } else {
+        *id = vec__len_st(st->shares);
+        if (vec__reserve(st->sets, *id + 1) || __vec__push(st->shares, &share, sizeof(share))) {
+            vec__free(share.jobs);
+            return -1;
+        }
+        __vec__push(st->sets, (void *)crn_s, sizeof(*crn_s));
+    }
+    if (hmap__add(&st->keys, key, *id) || __vec__push(st->added, id, sizeof(*id))) {
+        hmap__del(&st->keys, key, *id);
+        vec__free(share.jobs);
+        ((struct share *)__vec__at(st->shares, *id))->jobs = NULL;
+        __vec__push(st->free_ids, id, sizeof(*id));
+        return -1;
+    }
+    ++st->live;
+    return 0;
+}
+
+/*
+ * Adds a job to the share of its schedule, which is created when it is the
+ * first one. id and pos are where the job went, for share__del().
+ */
+int share__add(struct share_tab *st, const cron_set *crn_s, struct clock_zone *zone,
+               size_t job, size_t *id, size_t *pos)
+{
+    uint64_t key = share__hash(crn_s, zone);
+    struct share *share;
+    size_t iter = 0;
+    size_t found;
+
+    while ((found = hmap__next(&st->keys, key, &iter)) != SIZE_MAX) {
+        if (share__same(st, found, crn_s, zone))
+            break;
+    }
+    if (found == SIZE_MAX && share__new(st, crn_s, zone, key, &found))
+        return -1;
+    share = __vec__at(st->shares, found);
+    if (__vec__push(share->jobs, &job, sizeof(job)))
+        return -1;
+    *id = found;
+    *pos = vec__len_st(share->jobs) - 1;
+    return 0;
+}
+
+/*
+ * Takes the job at pos out of a share, the last job of the share moves into
+ * its place and *moved is its id, SIZE_MAX if none moved. A share without
+ * jobs is freed and goes to removed.
+ */
+int share__del(struct share_tab *st, size_t id, size_t pos, size_t *moved)
+{
+    struct share *share = __vec__at(st->shares, id);
+    size_t last = vec__len_st(share->jobs) - 1;
+    size_t *jobs = __vec__at(share->jobs, 0);
+
+    *moved = SIZE_MAX;
+    if (pos != last) {
+        jobs[pos] = jobs[last];
+        *moved = jobs[pos];
+    }
+    vec__pop(share->jobs);
+    if (!vec__is_empty(share->jobs))
+        return 0;
+
+    hmap__del(&st->keys, share__hash(__vec__at(st->sets, id), share->zone), id);
+    vec__free(share->jobs);
+    share->jobs = NULL;
+    --st->live;
+    if (__vec__push(st->removed, &id, sizeof(id)) ||
+        __vec__push(st->free_ids, &id, sizeof(id)))
+        return -1;
+    return 0;
+}
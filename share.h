@@ -0,0 +1,40 @@
+#ifndef SHARE_H
+#define SHARE_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "cron.h"
+#include "hash.h"
+#include "vec.h"
+
+/* the jobs with the same schedule and zone, evaluated once for all of them */
+struct share {
+    struct clock_zone *zone;
+    size_t *jobs; /* vector of job ids, NULL while the slot is free */
+    time_t next; /* next fire time, -1 if never */
+};
+
+/*
+ * Interns the schedules of a job table, so that fire times are computed
+ * and engines are fed per distinct schedule instead of per job.
+ */
+struct share_tab {
+    cron_set *sets; /* vector, the schedule of each share, kept dense for scans */
+    struct share *shares; /* vector, the rest by the same id, freed ones stay as free slots */
+    struct pool lists; /* where the jobs vectors of the shares come from */
+    size_t *free_ids; /* vector of free slots that can be reused */
+    struct hmap keys; /* schedule hash to share ids */
+    size_t *added; /* vector of the shares created since share__begin() */
+    size_t *removed; /* vector of the shares emptied since share__begin() */
+    size_t live;
+};
+
+int share__init(struct share_tab *st);
+void share__free(struct share_tab *st);
+void share__begin(struct share_tab *st);
+int share__add(struct share_tab *st, const cron_set *crn_s, struct clock_zone *zone,
+               size_t job, size_t *id, size_t *pos);
+int share__del(struct share_tab *st, size_t id, size_t pos, size_t *moved);
+
+#endif
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util.h"
+#include "vec.h"
+#include "clock.h"
+#include "sim.h"
+
+#define TIME_FMT "%Y-%m-%d %H:%M"
+
+static const struct cron_tab *sort_tab;
+
+/* jobs of the same minute are printed in crontab order */
+static int sim__cmp_line(const void *a, const void *b)
+{
+    const cron_job *x = __vec__at(sort_tab->jobs, *(const size_t *)a);
+    const cron_job *y = __vec__at(sort_tab->jobs, *(const size_t *)b);
+
+    return (x->line > y->line) - (x->line < y->line);
+}
+
+static void sim__print(const cron_job *job, const char *when)
+{
+    printf("%s %d", when, job->line);
+    for (char **arg = job->argv; *arg; arg++)
+        printf(" %s", *arg);
+    putchar('\n');
+}
+
+/*
+ * Prints every fire time in [from, to) as "YYYY-MM-DD HH:MM line argv...",
+ * ordered by time and line, so that the output of two versions of a
+ * crontab can be diffed. The engine is driven by the fire times alone,
+ * nothing sleeps and nothing is launched.
+ */
+int sim__run(const struct cron_tab *tab, const struct engine *engine, time_t from, time_t to)
+{
+    struct clock_zone *zone = clock__local_zone();
+    void *sched = engine->new(from);
+    size_t *due = vec__new(sizeof(size_t));
+    size_t fires = 0;
+    size_t busiest = 0;
+    time_t busiest_at = -1;
+    time_t now;
+    char when[32];
+    int popped;
+    int err = -1;
+
+    if (!zone || !sched || !due)
+        goto out;
+    for (size_t id = 0; id < vec__len_st(tab->shares.shares); id++) {
+        const struct share *share = __vec__at(tab->shares.shares, id);
+        const cron_set *crn_s = __vec__at(tab->shares.sets, id);
+        time_t next;
+
+        if (!share->jobs)
+            continue;
+        next = cron_next_fire(crn_s, share->zone, from - 1);
+        if (next != -1 && next < to && engine->add(sched, next, id, crn_s, share->zone))
+            goto out;
+    }
+
+    while ((now = engine->next(sched)) != -1 && now < to) {
+        struct tm info;
+        size_t id;
+
+        /* the wheel's next() may be early, then nothing is due yet */
+        vec__resize(due, 0);
+        while ((popped = engine->pop(sched, now, &id)) > 0) {
+            const struct share *share = __vec__at(tab->shares.shares, id);
+            const cron_set *crn_s = __vec__at(tab->shares.sets, id);
+            time_t next = cron_next_fire(crn_s, share->zone, now);
+
+            for (size_t i = 0; i < vec__len_st(share->jobs); i++) {
+                if (__vec__push(due, __vec__at(share->jobs, i), sizeof(size_t)))
+                    goto out;
+            }
+            if (next != -1 && next < to && engine->add(sched, next, id, crn_s, share->zone))
+                goto out;
+        }
+        if (popped < 0)
+            goto out;
+        if (vec__is_empty(due))
+            continue;
+
+        sort_tab = tab;
+        qsort(__vec__at(due, 0), vec__len_st(due), sizeof(size_t), sim__cmp_line);
+        clock__local(zone, now, &info);
+        strftime(when, sizeof(when), TIME_FMT, &info);
+        for (size_t i = 0; i < vec__len_st(due); i++)
+            sim__print(__vec__at(tab->jobs, *(size_t *)__vec__at(due, i)), when);
+
+        fires += vec__len_st(due);
+        if (vec__len_st(due) > busiest) {
+            busiest = vec__len_st(due);
+            busiest_at = now;
+        }
+    }
+    fflush(stdout);
+
+    pr_err("%zu fires of %zu jobs", fires, tab->live);
+    if (busiest_at != -1) {
+        struct tm info;
+
+        clock__local(zone, busiest_at, &info);
+        strftime(when, sizeof(when), TIME_FMT, &info);
+        pr_err(", busiest minute %s with %zu", when, busiest);
+    }
+    pr_err("\n");
+    err = 0;
+out:
+    if (sched)
+        engine->free(sched);
+    vec__free(due);
+    return err;
+}
@@ -0,0 +1,11 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <time.h>
+
+#include "engine.h"
+#include "tab.h"
+
+int sim__run(const struct cron_tab *tab, const struct engine *engine, time_t from, time_t to);
+
+#endif
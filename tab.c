@@ -0,0 +1,657 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "file.h"
+#include "vec.h"
+#include "tab.h"
+
+/* smallest share of the crontab worth a parser thread */
+#define CHUNK_MIN (256 * 1024)
+
+int tab__init(struct cron_tab *tab)
+{
+    memset(tab, 0, sizeof(*tab));
+    arena__init(&tab->env_arena);
+    arena__init(&tab->argvs);
+    tab->jobs = vec__new(sizeof(cron_job));
+    tab->runs = vec__new(sizeof(struct cron_run));
+    tab->free_ids = vec__new(sizeof(size_t));
+    tab->envs = vec__new(sizeof(char **));
+    tab->zones = vec__new(sizeof(struct clock_zone *));
+    tab->added = vec__new(sizeof(size_t));
+    tab->removed = vec__new(sizeof(size_t));
+    if (!tab->jobs || !tab->runs || !tab->free_ids || !tab->envs || !tab->zones || !tab->added ||
+        !tab->removed || hmap__init(&tab->keys) || share__init(&tab->shares)) {
+        tab__free(tab);
+        return -1;
+    }
+    tab->indexed = true;
+    return 0;
+}
+
+/* the argv array and the strings after it */
+static size_t tab__argv_size(char **argv)
+{
+    size_t bytes = sizeof(char *);
+
+    for (; *argv; ++argv)
+        bytes += sizeof(char *) + strlen(*argv) + 1;
+    return bytes;
+}
+
+static bool tab__in_image(struct cron_tab *tab, char **argv)
+{
+    uintptr_t p = (uintptr_t)argv;
+    uintptr_t image = (uintptr_t)tab->image_argv;
+
+    return p >= image && p < image + tab->image_nargv * sizeof(char *);
+}
+
+/* the space stays taken in the arena until tab__compact() */
+static void tab__free_argv(struct cron_tab *tab, char **argv)
+{
+    if (argv && !tab__in_image(tab, argv))
+        tab->argv_dead += tab__argv_size(argv);
+}
+
+/*
+ * After a load, old holds the argv of the earlier loads and tab->argvs the
+ * ones parsed by this load. Once removed jobs left more than half of old
+ * unused, the argv of the jobs that are still in old move over and old is
+ * freed as a whole, otherwise it is kept as part of tab->argvs. Not being
+ * able to move is no error, old just stays.
+ */
+static void tab__compact(struct cron_tab *tab, struct arena *old)
+{
+    if (tab->argv_dead * 2 <= old->used) {
+        arena__merge(&tab->argvs, old);
+        return;
+    }
+    for (size_t id = 0; id < vec__len_st(tab->jobs); id++) {
+        cron_job *job = __vec__at(tab->jobs, id);
+        size_t size;
+        char **copy;
+
+        if (job->dead || tab__in_image(tab, job->argv) || arena__owns(&tab->argvs, job->argv))
+            continue;
+        size = tab__argv_size(job->argv);
+        copy = arena__alloc(&tab->argvs, size);
+        if (!copy) {
+            arena__merge(&tab->argvs, old);
+            return;
+        }
+        memcpy(copy, job->argv, size);
+        for (char **arg = copy; *arg; ++arg)
+            *arg = (char *)copy + (*arg - (char *)job->argv);
+        job->argv = copy;
+    }
+    arena__free(old);
+    tab->argv_dead = 0;
+}
+
+void tab__free(struct cron_tab *tab)
+{
+    for (size_t i = 0; tab->zones && i < vec__len_st(tab->zones); i++) {
+        struct clock_zone *zone = *(struct clock_zone **)__vec__at(tab->zones, i);
+
+        clock__free(zone);
+        free(zone);
+    }
+    vec__free(tab->jobs);
+    vec__free(tab->runs);
+    vec__free(tab->free_ids);
+    vec__free(tab->envs);
+    vec__free(tab->zones);
+    vec__free(tab->added);
+    vec__free(tab->removed);
+    hmap__free(&tab->keys);
+    share__free(&tab->shares);
+    arena__free(&tab->env_arena);
+    arena__free(&tab->argvs);
+    free(tab->image_argv);
+    file__unmap(&tab->image);
+    memset(tab, 0, sizeof(*tab));
+}
+
+static bool is_blank_or_comment(const char *line, size_t len)
+{
+    const char *end = line + len;
+
+    for (; line < end && (*line == ' ' || *line == '\t' || *line == '\r'); ++line) {}
+    return line == end || *line == '#';
+}
+
+/*
+ * The zone of a CRON_TZ value, loaded on first use and shared by all the
+ * entries that name it. An empty name is the daemon's zone, NULL.
+ */
+int tab__zone(struct cron_tab *tab, const char *name, size_t len, struct clock_zone **zone)
+{
+    char buf[PATH_MAX];
+    struct clock_zone *new_zone;
+
+    *zone = NULL;
+    if (!len)
+        return 0;
+    if (len >= sizeof(buf))
+        return -1;
+    memcpy(buf, name, len);
+    buf[len] = 0;
+    for (size_t i = 0; i < vec__len_st(tab->zones); i++) {
+        struct clock_zone *z = *(struct clock_zone **)__vec__at(tab->zones, i);
+
+        if (!strcmp(z->name, buf)) {
+            *zone = z;
+            return 0;
+        }
+    }
+
+    new_zone = malloc(sizeof(*new_zone));
+    if (!new_zone || clock__load(new_zone, buf)) {
+        free(new_zone);
+        return -1;
+    }
+    if (__vec__push(tab->zones, &new_zone, sizeof(new_zone))) {
+        clock__free(new_zone);
+        free(new_zone);
+        return -1;
+    }
+    *zone = new_zone;
+    return 0;
+}
+
+/* settings of the daemon given as CRON_* assignments */
+struct job_opts {
+    int max_running;
+    struct clock_zone *zone;
+};
+
+/*
+ * CRON_* assignments configure the entries below them instead of going into
+ * their environment. Returns 1 if assign isn't one of them.
+ */
+static int set_job_opt(struct cron_tab *tab, const struct cron_assign *assign,
+                       struct job_opts *opts)
+{
+    static const char prefix[] = "CRON_";
+    static const char max_running[] = "CRON_MAX_RUNNING";
+    static const char tz[] = "CRON_TZ";
+    char *end;
+    long val;
+
+    if (assign->name_len < sizeof(prefix) - 1 ||
+        strncmp(assign->name, prefix, sizeof(prefix) - 1))
+        return 1;
+
+    if (assign->name_len == sizeof(max_running) - 1 &&
+        !strncmp(assign->name, max_running, assign->name_len)) {
+        val = strtol(assign->value, &end, 10);
+        if (end != assign->value + assign->value_len || val < 0 || val > INT_MAX) {
+            pr_err("%s needs a number\n", max_running);
+            return -1;
+        }
+        opts->max_running = val;
+        return 0;
+    }
+    if (assign->name_len == sizeof(tz) - 1 && !strncmp(assign->name, tz, assign->name_len)) {
+        if (tab__zone(tab, assign->value, assign->value_len, &opts->zone)) {
+            pr_err("Unknown time zone %.*s\n", (int)assign->value_len, assign->value);
+            return -1;
+        }
+        return 0;
+    }
+    pr_err("Unknown setting %.*s\n", (int)assign->name_len, assign->name);
+    return -1;
+}
+
+/* a live job with this key that no line of the current load has claimed */
+static size_t tab__find(struct cron_tab *tab, uint64_t key)
+{
+    size_t iter = 0;
+    size_t id;
+
+    while ((id = hmap__next(&tab->keys, key, &iter)) != SIZE_MAX) {
+        if (((cron_job *)__vec__at(tab->jobs, id))->seen != tab->gen)
+            return id;
+    }
+    return SIZE_MAX;
+}
+
+/*
+ * The job is copied, the table owns its argv from now on. Its schedule and
+ * zone go to its share.
+ */
+int tab__add(struct cron_tab *tab, const cron_set *crn_s, struct clock_zone *zone,
+             const cron_job *job)
+{
+    struct cron_run run = { 0 };
+    cron_job *slot;
+    size_t id, share, pos;
+
+    if (!vec__is_empty(tab->free_ids)) {
+        id = *(size_t *)__vec__at(tab->free_ids, vec__len_st(tab->free_ids) - 1);
+        vec__pop(tab->free_ids);
+        *(cron_job *)__vec__at(tab->jobs, id) = *job;
+        *(struct cron_run *)__vec__at(tab->runs, id) = run;
+    } else {
+        id = vec__len_st(tab->jobs);
+        /* room for giving the id back below without another allocation */
+        if (vec__reserve(tab->free_ids, vec__len_st(tab->free_ids) + 1) ||
+            vec__reserve(tab->runs, id + 1) || __vec__push(tab->jobs, (void *)job, sizeof(*job)))
+            return -1;
+        __vec__push(tab->runs, &run, sizeof(run));
+    }
+    slot = __vec__at(tab->jobs, id);
+    if (tab->indexed && hmap__add(&tab->keys, job->key, id))
+        goto err;
+    if (__vec__push(tab->added, &id, sizeof(id)))
+        goto err;
+    if (share__add(&tab->shares, crn_s, zone, id, &share, &pos)) {
+        vec__pop(tab->added);
+        goto err;
+    }
+    slot->share = share;
+    slot->share_pos = pos;
+    ++tab->live;
+    return 0;
+
+err:
+    /* the slot is already taken, leave it as a dead job with a free id */
+    slot->argv = NULL;
+    slot->dead = true;
+    hmap__del(&tab->keys, job->key, id);
+    __vec__push(tab->free_ids, &id, sizeof(id));
+    return -1;
+}
+
+static int tab__index(struct cron_tab *tab)
+{
+    for (size_t id = 0; id < vec__len_st(tab->jobs); id++) {
+        cron_job *job = __vec__at(tab->jobs, id);
+
+        if (!job->dead && hmap__add(&tab->keys, job->key, id))
+            return -1;
+    }
+    tab->indexed = true;
+    return 0;
+}
+
+/* drops the live jobs that no line claimed in this load */
+static int tab__sweep(struct cron_tab *tab)
+{
+    size_t moved;
+
+    for (size_t id = 0; id < vec__len_st(tab->jobs); id++) {
+        cron_job *job = __vec__at(tab->jobs, id);
+
+        if (job->dead || job->seen == tab->gen)
+            continue;
+        hmap__del(&tab->keys, job->key, id);
+        if (share__del(&tab->shares, job->share, job->share_pos, &moved))
+            return -1;
+        if (moved != SIZE_MAX)
+            ((cron_job *)__vec__at(tab->jobs, moved))->share_pos = job->share_pos;
+        tab__free_argv(tab, job->argv);
+        job->argv = NULL;
+        job->envp = NULL;
+        job->dead = true;
+        --tab->live;
+        if (__vec__push(tab->removed, &id, sizeof(id)))
+            return -1;
+        /* a job still running keeps its id until the last instance exits */
+        if (!((struct cron_run *)__vec__at(tab->runs, id))->running && tab__release(tab, id))
+            return -1;
+    }
+    return 0;
+}
+
+/* what the lines above the current one set up */
+struct tab_state {
+    int line;
+    uint64_t ctx_hash; /* of the assignments so far */
+    bool diff; /* there are jobs from an earlier load to match */
+    char **env;
+    struct job_opts opts;
+};
+
+/* an assignment line, hash is the one of the line. -1 if out of memory. */
+static int tab__assign(struct cron_tab *tab, struct tab_state *st,
+                       const struct cron_assign *assign, uint64_t hash)
+{
+    char **new_env;
+    int err;
+
+    st->ctx_hash = hash__mix(st->ctx_hash, hash);
+    err = set_job_opt(tab, assign, &st->opts);
+    if (err < 0) {
+        pr_err("Skipping line %d of the crontab\n", st->line);
+        ++tab->bad;
+    }
+    if (err <= 0)
+        return 0;
+
+    new_env = env_set(st->env, assign, &tab->env_arena.base);
+    if (!new_env || __vec__push(tab->envs, &new_env, sizeof(new_env)))
+        return -1;
+    st->env = new_env;
+    return 0;
+}
+
+/*
+ * An entry line, hash is the one of the line. It is parsed here unless a
+ * parser thread already did, then crn_s and argv are its result and argv
+ * is owned by the table from now on. -1 if out of memory.
+ */
+static int tab__entry(struct cron_tab *tab, const struct tab_state *st,
+                      const char *str, size_t len, uint64_t hash,
+                      const cron_set *crn_s, char **argv)
+{
+    uint64_t key = hash__mix(st->ctx_hash, hash);
+    size_t id = st->diff ? tab__find(tab, key) : SIZE_MAX;
+    cron_set parsed;
+    cron_job job;
+
+    if (id != SIZE_MAX) {
+        cron_job *old = __vec__at(tab->jobs, id);
+
+        tab__free_argv(tab, argv);
+        old->seen = tab->gen;
+        old->line = st->line;
+        /* the same assignments built an equal environment */
+        old->envp = st->env;
+        return 0;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.line = st->line;
+    job.envp = st->env;
+    job.max_running = st->opts.max_running;
+    job.key = key;
+    job.seen = tab->gen;
+    if (argv) {
+        job.argv = argv;
+    } else if (parse(str, len, &parsed, &job.argv, &tab->argvs.base)) {
+        pr_err("Skipping line %d of the crontab\n", st->line);
+        ++tab->bad;
+        return 0;
+    } else {
+        crn_s = &parsed;
+    }
+    if (tab__add(tab, crn_s, st->opts.zone, &job)) {
+        tab__free_argv(tab, job.argv);
+        pr_err("Failed to allocate the job table\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int tab__load_lines(struct cron_tab *tab, struct tab_state *st,
+                           const char *data, size_t len)
+{
+    struct file_lines it;
+    const char *str;
+    size_t str_len;
+
+    file__lines_init(&it, data, len);
+    while (!file__next_line(&it, &str, &str_len)) {
+        struct cron_assign assign;
+        uint64_t hash;
+        int err;
+
+        ++st->line;
+        if (is_blank_or_comment(str, str_len))
+            continue;
+
+        hash = hash__bytes(str, str_len, HASH_SEED);
+        if (!parse_assign(str, str_len, &assign))
+            err = tab__assign(tab, st, &assign, hash);
+        else
+            err = tab__entry(tab, st, str, str_len, hash, NULL, NULL);
+        if (err)
+            return err;
+    }
+    return 0;
+}
+
+enum {
+    LINE_ASSIGN,
+    LINE_ENTRY,
+    LINE_BAD,
+};
+
+/* a line a parser thread went through */
+struct tab_line {
+    const char *str;
+    size_t len;
+    int line; /* counted from the start of the chunk */
+    int kind;
+    uint64_t hash;
+    cron_set crn_s;
+    char **argv;
+};
+
+/* a newline aligned part of the crontab, parsed by one thread */
+struct tab_chunk {
+    pthread_t thread;
+    const char *data;
+    size_t len;
+    struct tab_line *lines; /* vector, blank lines and comments left out */
+    struct arena argvs; /* of the lines, the table takes it over */
+    int nlines;
+    int err;
+};
+
+/*
+ * Parses everything but assignments, which depend on the lines above.
+ * Errors are left for the merge to report, in order and with the right
+ * line number.
+ */
+static void *tab__parse_chunk(void *arg)
+{
+    struct tab_chunk *chunk = arg;
+    struct file_lines it;
+    struct tab_line l;
+
+    parse_set_quiet(true);
+    file__lines_init(&it, chunk->data, chunk->len);
+    while (!file__next_line(&it, &l.str, &l.len)) {
+        struct cron_assign assign;
+
+        ++chunk->nlines;
+        if (is_blank_or_comment(l.str, l.len))
+            continue;
+
+        l.line = chunk->nlines;
+        l.hash = hash__bytes(l.str, l.len, HASH_SEED);
+        l.argv = NULL;
+        if (!parse_assign(l.str, l.len, &assign)) {
+            l.kind = LINE_ASSIGN;
+        } else if (parse(l.str, l.len, &l.crn_s, &l.argv, &chunk->argvs.base)) {
+            l.kind = LINE_BAD;
+        } else {
+            l.kind = LINE_ENTRY;
+        }
+        if (__vec__push(chunk->lines, &l, sizeof(l))) {
+            chunk->err = -1;
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* the chunks' lines in file order, as if they were read one by one */
+static int tab__merge_chunk(struct cron_tab *tab, struct tab_state *st,
+                            struct tab_chunk *chunk, int base)
+{
+    for (size_t i = 0; i < vec__len_st(chunk->lines); i++) {
+        struct tab_line *l = __vec__at(chunk->lines, i);
+        struct cron_assign assign;
+        int err;
+
+        st->line = base + l->line;
+        if (l->kind == LINE_ASSIGN) {
+            parse_assign(l->str, l->len, &assign);
+            err = tab__assign(tab, st, &assign, l->hash);
+        } else {
+            /* a bad line is parsed again to print why */
+            err = tab__entry(tab, st, l->str, l->len, l->hash, &l->crn_s, l->argv);
+            l->argv = NULL;
+        }
+        if (err)
+            return err;
+    }
+    return 0;
+}
+
+/*
+ * Splits the crontab into one newline aligned chunk per thread, parses
+ * them in parallel and merges the results in file order. When a thread
+ * can't be started the chunks are dropped and the crontab is read in one
+ * go instead.
+ */
+static int tab__load_chunks(struct cron_tab *tab, struct tab_state *st,
+                            const char *data, size_t len)
+{
+    size_t n = min((size_t)tab->threads, len / CHUNK_MIN);
+    const char *pos = data;
+    const char *end = data + len;
+    struct tab_chunk *chunks;
+    size_t started = 0;
+    bool serial = false;
+    int base = 0;
+    int err = 0;
+
+    chunks = calloc(n, sizeof(*chunks));
+    if (!chunks)
+        return -1;
+
+    for (size_t i = 0; i < n; i++) {
+        const char *stop = i == n - 1 ? end : data + len / n * (i + 1);
+
+        if (stop <= pos) {
+            stop = pos;
+        } else if (stop < end) {
+            /* a chunk ends right after a newline */
+            const char *nl = memchr(stop - 1, '\n', end - stop + 1);
+
+            stop = nl ? nl + 1 : end;
+        }
+        chunks[i].data = pos;
+        chunks[i].len = stop - pos;
+        pos = stop;
+        arena__init(&chunks[i].argvs);
+        chunks[i].lines = vec__new(sizeof(struct tab_line));
+        if (!chunks[i].lines) {
+            err = -1;
+            break;
+        }
+        if (pthread_create(&chunks[i].thread, NULL, tab__parse_chunk, &chunks[i])) {
+            pr_debug("Failed to start a parser thread, parsing in one go\n");
+            serial = true;
+            break;
+        }
+        ++started;
+    }
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(chunks[i].thread, NULL);
+        if (chunks[i].err)
+            err = -1;
+    }
+
+    /* nothing was merged yet, the lines parsed so far just go away */
+    if (serial) {
+        for (size_t i = 0; i < n; i++) {
+            arena__free(&chunks[i].argvs);
+            vec__free(chunks[i].lines);
+        }
+        free(chunks);
+        return tab__load_lines(tab, st, data, len);
+    }
+
+    for (size_t i = 0; !err && i < started; i++) {
+        err = tab__merge_chunk(tab, st, &chunks[i], base);
+        base += chunks[i].nlines;
+    }
+
+    /* in one piece with the other argvs, the lines not merged included */
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; chunks[i].lines && j < vec__len_st(chunks[i].lines); j++)
+            tab__free_argv(tab, ((struct tab_line *)__vec__at(chunks[i].lines, j))->argv);
+        arena__merge(&tab->argvs, &chunks[i].argvs);
+        vec__free(chunks[i].lines);
+    }
+    free(chunks);
+    return err;
+}
+
+/* starts a new load, the jobs it doesn't see again are removed */
+void tab__begin(struct cron_tab *tab)
+{
+    ++tab->gen;
+    tab->bad = 0;
+    vec__resize(tab->added, 0);
+    vec__resize(tab->removed, 0);
+    share__begin(&tab->shares);
+}
+
+/*
+ * Reads the crontab and diffs it against the jobs already loaded. Each
+ * entry is keyed by a hash of its line, chained onto the hashes of the
+ * assignments above it, so an unchanged key means an unchanged job and the
+ * line is not parsed again. Only new keys are parsed, jobs whose key is
+ * gone are removed, the ids of both end up in added and removed. Blank
+ * lines and comments are skipped, and so are lines that fail to parse.
+ * Lines are parsed in place, data doesn't have to be NUL terminated.
+ */
+int tab__load(struct cron_tab *tab, const char *data, size_t len)
+{
+    struct tab_state st = { .ctx_hash = HASH_SEED, .diff = tab->live };
+    size_t old_envs = vec__len_st(tab->envs);
+    struct arena old_env_arena;
+    struct arena old_argvs;
+    int err;
+
+    tab__begin(tab);
+    if (st.diff && !tab->indexed && tab__index(tab))
+        return -1;
+    /* what this load allocates goes to arenas of its own */
+    old_env_arena = tab->env_arena;
+    old_argvs = tab->argvs;
+    arena__init(&tab->env_arena);
+    arena__init(&tab->argvs);
+
+    /* with nothing to diff against every line gets parsed, do so in parallel */
+    if (!tab->live && tab->threads > 1 && len >= 2 * CHUNK_MIN)
+        err = tab__load_chunks(tab, &st, data, len);
+    else
+        err = tab__load_lines(tab, &st, data, len);
+
+    if (!err && tab__sweep(tab))
+        err = -1;
+    /* the old environments stay, the jobs that weren't seen still use them */
+    if (err) {
+        arena__merge(&tab->env_arena, &old_env_arena);
+        arena__merge(&tab->argvs, &old_argvs);
+        return err;
+    }
+
+    arena__free(&old_env_arena);
+    tab__compact(tab, &old_argvs);
+    memmove(__vec__at(tab->envs, 0), __vec__at(tab->envs, old_envs),
+            (vec__len_st(tab->envs) - old_envs) * sizeof(char **));
+    vec__resize(tab->envs, vec__len_st(tab->envs) - old_envs);
+
+    pr_debug("Loaded %zu jobs, %d new and %d removed\n", tab->live,
+             vec__len(tab->added), vec__len(tab->removed));
+    return 0;
+}
+
+/* makes the id of a dead job available again once nothing refers to it */
+int tab__release(struct cron_tab *tab, size_t id)
+{
+    return __vec__push(tab->free_ids, &id, sizeof(id));
+}
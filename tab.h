@@ -0,0 +1,51 @@
+#ifndef TAB_H
+#define TAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cron.h"
+#include "clock.h"
+#include "file.h"
+#include "hash.h"
+#include "share.h"
+#include "vec.h"
+
+/*
+ * The jobs of a crontab, kept across reloads. A job's id is its index in
+ * jobs and runs and stays the same as long as its line is unchanged. The
+ * schedules live in shares, one dense array of them for all equal jobs.
+ */
+struct cron_tab {
+    cron_job *jobs; /* vector, removed jobs stay as dead slots */
+    struct cron_run *runs; /* vector, the run state of each job */
+    size_t *free_ids; /* vector of dead ids that can be reused */
+    char ***envs; /* vector of the environments built from assignment lines */
+    struct arena env_arena; /* where envs live, each load builds a new one */
+    struct arena argvs; /* where the argv of the jobs live */
+    size_t argv_dead; /* bytes of argvs the removed jobs left in argvs */
+    struct clock_zone **zones; /* vector of the zones CRON_TZ named, each loaded once */
+    struct hmap keys; /* line hash to the ids of the live jobs */
+    struct share_tab shares; /* the distinct schedules of the live jobs */
+    bool indexed; /* keys is filled in, after a cached load only once needed */
+    size_t *added; /* vector of the ids added by the last load */
+    size_t *removed; /* vector of the ids removed by the last load */
+    size_t live; /* number of live jobs */
+    size_t bad; /* lines the last load skipped */
+    int threads; /* parser threads for a first load */
+    uint32_t gen; /* bumped on every load */
+    struct file_map image; /* the cache the jobs were loaded from */
+    char **image_argv; /* argv of the cached jobs, pointing into image */
+    size_t image_nargv;
+};
+
+int tab__init(struct cron_tab *tab);
+void tab__free(struct cron_tab *tab);
+void tab__begin(struct cron_tab *tab);
+int tab__add(struct cron_tab *tab, const cron_set *crn_s, struct clock_zone *zone,
+             const cron_job *job);
+int tab__load(struct cron_tab *tab, const char *data, size_t len);
+int tab__release(struct cron_tab *tab, size_t id);
+int tab__zone(struct cron_tab *tab, const char *name, size_t len, struct clock_zone **zone);
+
+#endif
@@ -3,15 +3,211 @@
 #include <assert.h>
 #include <stdint.h>
 #include <errno.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "vec.h"
+
 #define DEFAULT_VEC_SIZE 16
+#define ARENA_ALIGN alignof(max_align_t)
+#define ARENA_BLOCK_MIN 4096 /* a page, blocks are multiples of it */
+#define ARENA_BLOCK_MAX (8 * 1024 * 1024)
 
 struct vec {
 	size_t len; /* number of members */
 	size_t mem_size; /* size of a single element */
 	size_t capacity; /* in bytes */
 	char *raw;
+	struct allocator *a; /* NULL for malloc */
+};
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size; /* usable bytes */
+	size_t used;
+	alignas(ARENA_ALIGN) char data[];
 };
 
+static void *arena__realloc(struct allocator *base, void *p, size_t old_size, size_t size)
+{
+	struct arena *a = (struct arena *)base;
+	struct arena_block *b = a->head;
+	void *__new;
+
+	old_size = (old_size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	// the most recent allocation can shrink and grow in place
+	if (p && b && (char *)p + old_size == b->data + b->used) {
+		size_t size_al = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+		if (size_al <= b->size - b->used + old_size) {
+			b->used = b->used - old_size + size_al;
+			a->used = a->used - old_size + size_al;
+			return size ? p : NULL;
+		}
+	}
+	if (size <= old_size)
+		return size ? p : NULL;
+	__new = arena__alloc(a, size);
+	if (__new && p)
+		memcpy(__new, p, old_size);
+	return __new;
+}
+
+void arena__init(struct arena *a)
+{
+	a->base.realloc = arena__realloc;
+	a->head = NULL;
+	a->used = 0;
+}
+
+// blocks are mapped on their own, so that freeing them gives the memory
+// back to the system rather than to malloc
+static struct arena_block *arena__block(size_t size)
+{
+	size_t total = (offsetof(struct arena_block, data) + size + ARENA_BLOCK_MIN - 1) &
+		~(size_t)(ARENA_BLOCK_MIN - 1);
+	struct arena_block *b;
+
+	b = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (b == MAP_FAILED)
+		return NULL;
+	b->size = total - offsetof(struct arena_block, data);
+	b->used = 0;
+	return b;
+}
+
+// blocks double in size up to ARENA_BLOCK_MAX, the rest of a block too
+// small for an allocation is left unused
+void *arena__alloc(struct arena *a, size_t size)
+{
+	struct arena_block *b = a->head;
+	void *p;
+
+	if (size > SIZE_MAX - 2 * ARENA_BLOCK_MIN)
+		return NULL;
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if (!b || b->size - b->used < size) {
+		size_t block = b ? b->size * 2 : 0;
+
+		if (block > ARENA_BLOCK_MAX)
+			block = ARENA_BLOCK_MAX;
+		if (block < size)
+			block = size;
+		b = arena__block(block);
+		if (b == NULL)
+			return NULL;
+		b->next = a->head;
+		a->head = b;
+	}
+	p = b->data + b->used;
+	b->used += size;
+	a->used += size;
+	return p;
+}
+
+// moves the blocks of src to dst, which keeps allocating from its own head
+void arena__merge(struct arena *dst, struct arena *src)
+{
+	struct arena_block *tail = src->head;
+
+	if (!tail)
+		return;
+	if (!dst->head) {
+		dst->head = src->head;
+	} else {
+		while (tail->next)
+			tail = tail->next;
+		tail->next = dst->head->next;
+		dst->head->next = src->head;
+	}
+	dst->used += src->used;
+	arena__init(src);
+}
+
+// whether p was allocated from a
+int arena__owns(const struct arena *a, const void *p)
+{
+	for (const struct arena_block *b = a->head; b; b = b->next) {
+		if ((const char *)p >= b->data && (const char *)p < b->data + b->used)
+			return 1;
+	}
+	return 0;
+}
+
+// one unmap per block, not a free per allocation
+void arena__free(struct arena *a)
+{
+	struct arena_block *b = a->head;
+
+	while (b) {
+		struct arena_block *next = b->next;
+
+		munmap(b, offsetof(struct arena_block, data) + b->size);
+		b = next;
+	}
+	arena__init(a);
+}
+
+static void pool__put(struct pool *pool, void *p)
+{
+	*(void **)p = pool->free;
+	pool->free = p;
+}
+
+static void *pool__realloc(struct allocator *base, void *p, size_t old_size, size_t size)
+{
+	struct pool *pool = (struct pool *)base;
+	void *__new;
+
+	if (p && old_size > pool->size) {
+		// a malloc allocation
+		if (!size) {
+			free(p);
+			return NULL;
+		}
+		if (size > pool->size)
+			return realloc(p, size);
+	} else if (p && size <= pool->size) {
+		// stays in its object
+		if (!size)
+			pool__put(pool, p);
+		return size ? p : NULL;
+	}
+
+	if (size > pool->size) {
+		__new = malloc(size);
+	} else if (pool->free) {
+		__new = pool->free;
+		pool->free = *(void **)__new;
+	} else {
+		__new = arena__alloc(&pool->arena, pool->size);
+	}
+	if (__new && p) {
+		memcpy(__new, p, old_size < size ? old_size : size);
+		if (old_size > pool->size)
+			free(p);
+		else
+			pool__put(pool, p);
+	}
+	return __new;
+}
+
+void pool__init(struct pool *p, size_t size)
+{
+	p->base.realloc = pool__realloc;
+	p->size = size < sizeof(void *) ? sizeof(void *) : size;
+	p->free = NULL;
+	arena__init(&p->arena);
+}
+
+// the objects still handed out go with it
+void pool__free(struct pool *p)
+{
+	arena__free(&p->arena);
+	p->free = NULL;
+}
+
 int __vec__expand(struct vec *vec, size_t size_least);
 
 // reserve num number of elements for the vector, do so by allocating memory exponentially
@@ -33,20 +229,27 @@ int vec__reserve(void *__vec, size_t num)
 
 void *vec__new(size_t mem_size)
 {
-	struct vec *vec = malloc(sizeof(struct vec));
+	return vec__new_in(mem_size, NULL);
+}
+
+// the header and the elements both come from a
+void *vec__new_in(size_t mem_size, struct allocator *a)
+{
+	struct vec *vec = mem__alloc(a, sizeof(struct vec));
 
 	if (vec == NULL)
 		return NULL;
 
-	vec->raw = malloc(DEFAULT_VEC_SIZE);
+	vec->raw = mem__alloc(a, DEFAULT_VEC_SIZE);
 	if (vec->raw == NULL) {
-		free(vec);
+		mem__free(a, vec, sizeof(struct vec));
 		return NULL;
     }
 
 	vec->len = 0;
 	vec->mem_size = mem_size;
 	vec->capacity = DEFAULT_VEC_SIZE;
+	vec->a = a;
 
 	return vec;
 }
@@ -57,8 +260,8 @@ void vec__free(void *__vec)
 
 	if (!vec)
 		return;
-	free(vec->raw);
-	free(vec);
+	mem__free(vec->a, vec->raw, vec->capacity);
+	mem__free(vec->a, vec, sizeof(struct vec));
 }
 
 int __vec__expand(struct vec *vec, size_t size_least)
@@ -74,7 +277,10 @@ int __vec__expand(struct vec *vec, size_t size_least)
 		capacity_old = capacity;
 	}
 
-	__new = realloc(vec->raw, capacity);
+	if (vec->a)
+		__new = vec->a->realloc(vec->a, vec->raw, vec->capacity, capacity);
+	else
+		__new = realloc(vec->raw, capacity);
 	if (__new == NULL)
 		return -ENOMEM;
 
@@ -110,7 +316,7 @@ void vec__pop(void *__vec)
 		--vec->len;
 }
 
-void *__vec__at(void *__vec, size_t pos)
+void *__vec__at(const void *__vec, size_t pos)
 {
 	const struct vec *vec = __vec;
 
@@ -142,7 +348,7 @@ int vec__is_empty(const void *__vec)
 }
 
 // expand the vector so that it can take at least (cap + size) bytes of data
-int vec__alloc(struct vec *__vec, size_t size)
+int vec__alloc(void *__vec, size_t size)
 {
 	struct vec *vec = __vec;
 	size_t cap = vec__cap(vec);
@@ -152,7 +358,7 @@ int vec__alloc(struct vec *__vec, size_t size)
 }
 
 // this will not expand the vector
-void vec__len_inc(struct vec *__vec, size_t size)
+void vec__len_inc(void *__vec, size_t size)
 {
 	struct vec *vec = __vec;
 
@@ -2,8 +2,57 @@
 #define VEC_H
 
 #include <stddef.h>
+#include <stdlib.h>
+
+// where memory comes from, a NULL allocator means malloc
+//   realloc(a, NULL, 0, size) allocates, realloc(a, p, old_size, 0) frees
+// old_size is the size p was last allocated with
+struct allocator {
+	void *(*realloc)(struct allocator *a, void *p, size_t old_size, size_t size);
+};
+
+static inline void *mem__alloc(struct allocator *a, size_t size)
+{
+	return a ? a->realloc(a, NULL, 0, size) : malloc(size);
+}
+
+static inline void mem__free(struct allocator *a, void *p, size_t size)
+{
+	if (a)
+		a->realloc(a, p, size, 0);
+	else
+		free(p);
+}
+
+// a region that is freed as a whole, freeing a single allocation only
+// gives back the most recent one
+struct arena_block;
+struct arena {
+	struct allocator base;
+	struct arena_block *head; // the block allocations come from
+	size_t used; // bytes handed out, over all blocks
+};
+
+void arena__init(struct arena *a);
+void *arena__alloc(struct arena *a, size_t size);
+void arena__merge(struct arena *dst, struct arena *src);
+int arena__owns(const struct arena *a, const void *p);
+void arena__free(struct arena *a);
+
+// objects of one size, returned ones are handed out again, larger requests
+// fall through to malloc
+struct pool {
+	struct allocator base;
+	size_t size; // of an object
+	void *free; // list of returned objects
+	struct arena arena; // where new objects are carved from
+};
+
+void pool__init(struct pool *p, size_t size);
+void pool__free(struct pool *p);
 
 void *vec__new(size_t mem_size);
+void *vec__new_in(size_t mem_size, struct allocator *a);
 void vec__free(void *__vec);
 void vec__pop(void *__vec);
 size_t vec__len_st(const void *__vec);
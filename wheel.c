@@ -0,0 +1,293 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "engine.h"
+#include "vec.h"
+
+/*
+ * A hierarchical timing wheel with a resolution of one minute. Times are
+ * counted in minutes since the epoch, the minute level holds the timers of
+ * the current hour, the hour level those of the current day and the day
+ * level the next DAY_SLOTS days. Anything further away waits in an overflow
+ * list that is redistributed every DAY_SLOTS days. Timers cascade one level
+ * down when the wheel enters their hour or day, so adding and expiring a
+ * timer is O(1) amortized.
+ */
+
+#define ONE_MIN 60
+#define MINS_PER_HOUR 60
+#define HOURS_PER_DAY 24
+#define MINS_PER_DAY (MINS_PER_HOUR * HOURS_PER_DAY)
+#define DAY_SLOTS 64
+#define NIL SIZE_MAX
+
+enum {
+    SLOT_MINUTE = 0,
+    SLOT_HOUR = SLOT_MINUTE + MINS_PER_HOUR,
+    SLOT_DAY = SLOT_HOUR + HOURS_PER_DAY,
+    SLOT_OVERFLOW = SLOT_DAY + DAY_SLOTS,
+    SLOT_READY, /* expired, waiting to be popped */
+    SLOT_NUM,
+    SLOT_NONE = -1,
+};
+
+/* indexed by job id, timers are linked into their slot's list */
+struct wheel_node {
+    time_t when;
+    size_t prev;
+    size_t next;
+    int slot;
+};
+
+struct wheel {
+    time_t cur; /* the first minute that has not expired yet */
+    struct wheel_node *nodes; /* vector */
+    size_t heads[SLOT_NUM];
+    /* non-empty slots of each level */
+    uint64_t minute_bits;
+    uint32_t hour_bits;
+    uint64_t day_bits;
+};
+
+/* lowest set bit of mask at or above bit, -1 if there is none */
+static int next_bit(uint64_t mask, int bit)
+{
+    if (bit > 63)
+        return -1;
+    mask &= ~0ULL << bit;
+    return mask ? __builtin_ctzll(mask) : -1;
+}
+
+static struct wheel_node *wheel__node(struct wheel *w, size_t id)
+{
+    return __vec__at(w->nodes, id);
+}
+
+static void wheel__mark(struct wheel *w, int slot, int nonempty)
+{
+    uint64_t *bits;
+    int bit;
+
+    if (slot < SLOT_HOUR) {
+        bits = &w->minute_bits;
+        bit = slot - SLOT_MINUTE;
+    } else if (slot < SLOT_DAY) {
+        /* hour_bits is only 32 bits wide */
+        uint32_t mask = 1U << (slot - SLOT_HOUR);
+
+        w->hour_bits = nonempty ? w->hour_bits | mask : w->hour_bits & ~mask;
+        return;
+    } else if (slot < SLOT_OVERFLOW) {
+        bits = &w->day_bits;
+        bit = slot - SLOT_DAY;
+    } else {
+        return;
+    }
+    *bits = nonempty ? *bits | 1ULL << bit : *bits & ~(1ULL << bit);
+}
+
+static void wheel__link(struct wheel *w, size_t id, int slot)
+{
+    struct wheel_node *node = wheel__node(w, id);
+
+    node->slot = slot;
+    node->prev = NIL;
+    node->next = w->heads[slot];
+    if (node->next != NIL)
+        wheel__node(w, node->next)->prev = id;
+    w->heads[slot] = id;
+    wheel__mark(w, slot, 1);
+}
+
+static void wheel__unlink(struct wheel *w, size_t id)
+{
+    struct wheel_node *node = wheel__node(w, id);
+
+    if (node->prev != NIL)
+        wheel__node(w, node->prev)->next = node->next;
+    else
+        w->heads[node->slot] = node->next;
+    if (node->next != NIL)
+        wheel__node(w, node->next)->prev = node->prev;
+    if (w->heads[node->slot] == NIL)
+        wheel__mark(w, node->slot, 0);
+    node->slot = SLOT_NONE;
+}
+
+/* the slot a timer belongs to, relative to the current minute */
+static int wheel__slot(const struct wheel *w, time_t when)
+{
+    time_t m = when / ONE_MIN;
+
+    if (m < w->cur)
+        return SLOT_READY;
+    if (m / MINS_PER_HOUR == w->cur / MINS_PER_HOUR)
+        return SLOT_MINUTE + m % MINS_PER_HOUR;
+    if (m / MINS_PER_DAY == w->cur / MINS_PER_DAY)
+        return SLOT_HOUR + m / MINS_PER_HOUR % HOURS_PER_DAY;
+    if (m / MINS_PER_DAY - w->cur / MINS_PER_DAY < DAY_SLOTS)
+        return SLOT_DAY + m / MINS_PER_DAY % DAY_SLOTS;
+    return SLOT_OVERFLOW;
+}
+
+/* moves every timer of slot to where it belongs now */
+static void wheel__cascade(struct wheel *w, int slot)
+{
+    size_t id = w->heads[slot];
+
+    w->heads[slot] = NIL;
+    wheel__mark(w, slot, 0);
+    while (id != NIL) {
+        struct wheel_node *node = wheel__node(w, id);
+        size_t next = node->next;
+
+        wheel__link(w, id, wheel__slot(w, node->when));
+        id = next;
+    }
+}
+
+/* called when cur reaches the start of an hour */
+static void wheel__enter_hour(struct wheel *w)
+{
+    if (w->cur % MINS_PER_DAY == 0) {
+        if (w->cur / MINS_PER_DAY % DAY_SLOTS == 0)
+            wheel__cascade(w, SLOT_OVERFLOW);
+        wheel__cascade(w, SLOT_DAY + w->cur / MINS_PER_DAY % DAY_SLOTS);
+    }
+    wheel__cascade(w, SLOT_HOUR + w->cur / MINS_PER_HOUR % HOURS_PER_DAY);
+}
+
+/* expires every minute up to and including the one of now */
+static void wheel__advance(struct wheel *w, time_t now)
+{
+    time_t target = now / ONE_MIN;
+
+    while (w->cur <= target) {
+        time_t hour = w->cur - w->cur % MINS_PER_HOUR;
+        int bit = next_bit(w->minute_bits, w->cur % MINS_PER_HOUR);
+
+        if (bit != -1 && hour + bit <= target) {
+            w->cur = hour + bit + 1;
+            wheel__cascade(w, SLOT_MINUTE + bit);
+        } else if (hour + MINS_PER_HOUR <= target + 1) {
+            /* nothing left in this hour */
+            w->cur = hour + MINS_PER_HOUR;
+        } else {
+            w->cur = target + 1;
+            break;
+        }
+        if (w->cur % MINS_PER_HOUR == 0)
+            wheel__enter_hour(w);
+    }
+}
+
+static void *wheel_engine__new(time_t now)
+{
+    struct wheel *w = calloc(1, sizeof(struct wheel));
+
+    if (!w)
+        return NULL;
+    w->nodes = vec__new(sizeof(struct wheel_node));
+    if (!w->nodes) {
+        free(w);
+        return NULL;
+    }
+    for (int i = 0; i < SLOT_NUM; i++)
+        w->heads[i] = NIL;
+    w->cur = now / ONE_MIN;
+    return w;
+}
+
+static void wheel_engine__free(void *sched)
+{
+    struct wheel *w = sched;
+
+    if (!w)
+        return;
+    vec__free(w->nodes);
+    free(w);
+}
+
+static int wheel_engine__add(void *sched, time_t when, size_t id, const cron_set *crn_s,
+                            struct clock_zone *zone)
+{
+    struct wheel *w = sched;
+    struct wheel_node node = { .slot = SLOT_NONE };
+
+    (void)crn_s;
+    (void)zone;
+    while (vec__len_st(w->nodes) <= id) {
+        if (__vec__push(w->nodes, &node, sizeof(node)))
+            return -1;
+    }
+    if (wheel__node(w, id)->slot != SLOT_NONE)
+        wheel__unlink(w, id);
+    wheel__node(w, id)->when = when;
+    wheel__link(w, id, wheel__slot(w, when));
+    return 0;
+}
+
+static void wheel_engine__remove(void *sched, size_t id)
+{
+    struct wheel *w = sched;
+
+    if (id < vec__len_st(w->nodes) && wheel__node(w, id)->slot != SLOT_NONE)
+        wheel__unlink(w, id);
+}
+
+/*
+ * Exact for timers of the current hour, otherwise the start of the first
+ * hour or day that has timers, the caller wakes up there and asks again
+ */
+static time_t wheel_engine__next(void *sched)
+{
+    struct wheel *w = sched;
+    time_t hour = w->cur - w->cur % MINS_PER_HOUR;
+    time_t day = w->cur - w->cur % MINS_PER_DAY;
+    time_t day_idx = w->cur / MINS_PER_DAY;
+    uint64_t days;
+    int bit;
+
+    if (w->heads[SLOT_READY] != NIL)
+        return (w->cur - 1) * ONE_MIN;
+
+    bit = next_bit(w->minute_bits, w->cur % MINS_PER_HOUR);
+    if (bit != -1)
+        return (hour + bit) * ONE_MIN;
+
+    bit = next_bit(w->hour_bits, w->cur / MINS_PER_HOUR % HOURS_PER_DAY + 1);
+    if (bit != -1)
+        return (day + bit * MINS_PER_HOUR) * ONE_MIN;
+
+    /* rotate so that bit 0 stands for tomorrow */
+    bit = (day_idx + 1) % DAY_SLOTS;
+    days = bit ? w->day_bits >> bit | w->day_bits << (DAY_SLOTS - bit) : w->day_bits;
+    if (days)
+        return (day_idx + 1 + __builtin_ctzll(days)) * MINS_PER_DAY * ONE_MIN;
+
+    if (w->heads[SLOT_OVERFLOW] != NIL)
+        return (day_idx / DAY_SLOTS + 1) * DAY_SLOTS * MINS_PER_DAY * ONE_MIN;
+    return -1;
+}
+
+static int wheel_engine__pop(void *sched, time_t now, size_t *id)
+{
+    struct wheel *w = sched;
+
+    wheel__advance(w, now);
+    if (w->heads[SLOT_READY] == NIL)
+        return 0;
+    *id = w->heads[SLOT_READY];
+    wheel__unlink(w, *id);
+    return 1;
+}
+
+const struct engine wheel_engine = {
+    .name = "wheel",
+    .new = wheel_engine__new,
+    .free = wheel_engine__free,
+    .add = wheel_engine__add,
+    .remove = wheel_engine__remove,
+    .next = wheel_engine__next,
+    .pop = wheel_engine__pop,
+};